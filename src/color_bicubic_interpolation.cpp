@@ -12,6 +12,12 @@
 #include "bicubic_interpolation.h"
 #include "transformation.h"
 
+#include <string.h>
+
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+
 
 /**
   *
@@ -95,9 +101,84 @@ float bicubic_interpolation(
 
 
 
+/**
+  *
+  * Round a weight to fixed point, inline; the offset makes the value
+  * positive, so the truncation is a floor
+  *
+**/
+inline int fixed_weight(float w)
+{
+  const float s=(float)(1<<BICUBIC_BITS);
+  const float offset=(float)(8<<BICUBIC_BITS);
+
+  return (int)(w*s+offset+0.5f)-(8<<BICUBIC_BITS);
+}
+
+
+/**
+  *
+  * Weights of the four samples of a cubic interpolation at t, from the 
+  * polynomial of cubic_interpolation, in fixed point
+  * They add exactly one, so constant regions are not modified
+  *
+**/
+inline void cubic_weights(
+  float t,  //position between the second and the third samples
+  int   w[4]//output weights
+)
+{
+  w[0]=fixed_weight(0.5f*t*(-1.0f+t*(2.0f-t)));
+  w[2]=fixed_weight(0.5f*t*(1.0f+t*(4.0f-3.0f*t)));
+  w[3]=fixed_weight(0.5f*t*t*(t-1.0f));
+  w[1]=(1<<BICUBIC_BITS)-w[0]-w[2]-w[3];
+}
+
+
+/**
+  *
+  * Positions of the four samples of a cubic interpolation at u, with the
+  * same boundary conditions as the interpolation of float images
+  *
+**/
+inline void cubic_points(
+  float u,  //position to be interpolated
+  int   n,  //number of samples
+  int   p[4]//output positions
+)
+{
+  int s=(u<0)? -1: 1;
+
+  p[0]=neumann_bc((int) u-s, n);
+  p[1]=neumann_bc((int) u, n);
+  p[2]=neumann_bc((int) u+s, n);
+  p[3]=neumann_bc((int) u+2*s, n);
+}
+
+
+/**
+  *
+  * Weights of the four samples of a cubic interpolation at t, from the 
+  * polynomial of cubic_interpolation
+  *
+**/
+inline void cubic_weights(
+  float t,    //position between the second and the third samples
+  float w[4]  //output weights
+)
+{
+  w[0]=0.5f*t*(-1.0f+t*(2.0f-t));
+  w[1]=1.0f+0.5f*t*t*(3.0f*t-5.0f);
+  w[2]=0.5f*t*(1.0f+t*(4.0f-3.0f*t));
+  w[3]=0.5f*t*t*(t-1.0f);
+}
+
+
 /**
   *
   * Compute the bicubic interpolation of an image from a parametric trasform
+  * The positions and the weights of the samples are computed once for each
+  * pixel and all the channels are interpolated together
   *
 **/
 void bicubic_interpolation(
@@ -110,22 +191,247 @@ void bicubic_interpolation(
   int nz          //number of channels of the image       
 )
 {
-  #pragma omp parallel for
-  for (int i=0; i<ny; i++)
-    for (int j=0; j<nx; j++)
+  float matrix[9];
+  params2matrix(params, matrix, nparams);
+
+  #pragma omp parallel
+  {
+    float *xr=new float[nx];
+    float *yr=new float[nx];
+
+    #pragma omp for
+    for (int i=0; i<ny; i++)
+    {
+      //transform the coordinates of the row using the parametric model
+      project_row(i, nx, matrix, xr, yr);
+
+      for (int j=0; j<nx; j++)
+      {
+        float *out=&output[(i*nx+j)*nz];
+        float x=xr[j], y=yr[j];
+
+        for(int k=0; k<nz; k++) out[k]=0;
+        if(x>nx || x<-1 || y>ny || y<-1) continue;
+
+        int   px[4], py[4];
+        float wx[4], wy[4];
+        cubic_points(x, nx, px);
+        cubic_points(y, ny, py);
+        cubic_weights(x-px[1], wx);
+        cubic_weights(y-py[1], wy);
+
+        //add the samples of the 4x4 neighborhood with all their channels
+        for(int m=0; m<4; m++)
+          for(int n=0; n<4; n++)
+          {
+            float w=wy[m]*wx[n];
+            float *in=&input[(px[n]+nx*py[m])*nz];
+            for(int k=0; k<nz; k++) out[k]+=w*in[k];
+          }
+      }
+    }
+
+    delete []xr;
+    delete []yr;
+  }
+}
+
+
+/**
+  *
+  * Round and clamp a fixed point value of the horizontal interpolation
+  *
+**/
+inline unsigned char fixed2byte(int v)
+{
+  const int bits=2*BICUBIC_BITS-BICUBIC_SHIFT;
+
+  v=(v+(1<<(bits-1)))>>bits;
+  if(v<0) return 0;
+  else if(v>255) return 255;
+  else return (unsigned char) v;
+}
+
+
+#ifdef __SSE4_1__
+/**
+  *
+  * Bicubic interpolation of an rgb pixel inside the image, whose 4x4
+  * neighborhood starts at (x-1, y-1)
+  * The vertical interpolation of the twelve values of each row is computed 
+  * in 32 bits lanes, multiplying pairs of rows of 16 bits values, and the
+  * horizontal one interpolates the three channels in the same register
+  *
+**/
+inline void bicubic_rgb(
+  unsigned char *input, //frame to be interpolated
+  unsigned char *output,//output pixel
+  int x,                //column of the second sample
+  int y,                //row of the second sample
+  int wx[4],            //horizontal weights
+  int wy[4],            //vertical weights
+  int nx                //width of the image
+)
+{
+  const __m128i zero=_mm_setzero_si128();
+  const __m128i w01=_mm_set1_epi32(
+    (int)(((unsigned) wy[1]<<16) | (unsigned short) wy[0])
+  );
+  const __m128i w23=_mm_set1_epi32(
+    (int)(((unsigned) wy[3]<<16) | (unsigned short) wy[2])
+  );
+
+  //load the twelve bytes of each row without reading beyond the frame
+  __m128i r[4];
+  unsigned char *p=input+((y-1)*nx+x-1)*3;
+  for(int j=0; j<4; j++, p+=nx*3)
+  {
+    int tail;
+    memcpy(&tail, p+8, sizeof(int));
+    r[j]=_mm_unpacklo_epi64(
+      _mm_loadl_epi64((__m128i *) p), _mm_cvtsi32_si128(tail)
+    );
+  }
+
+  __m128i a0=_mm_unpacklo_epi8(r[0], zero), b0=_mm_unpackhi_epi8(r[0], zero);
+  __m128i a1=_mm_unpacklo_epi8(r[1], zero), b1=_mm_unpackhi_epi8(r[1], zero);
+  __m128i a2=_mm_unpacklo_epi8(r[2], zero), b2=_mm_unpackhi_epi8(r[2], zero);
+  __m128i a3=_mm_unpacklo_epi8(r[3], zero), b3=_mm_unpackhi_epi8(r[3], zero);
+
+  __m128i v[3];
+  v[0]=_mm_add_epi32(
+    _mm_madd_epi16(_mm_unpacklo_epi16(a0, a1), w01),
+    _mm_madd_epi16(_mm_unpacklo_epi16(a2, a3), w23)
+  );
+  v[1]=_mm_add_epi32(
+    _mm_madd_epi16(_mm_unpackhi_epi16(a0, a1), w01),
+    _mm_madd_epi16(_mm_unpackhi_epi16(a2, a3), w23)
+  );
+  v[2]=_mm_add_epi32(
+    _mm_madd_epi16(_mm_unpacklo_epi16(b0, b1), w01),
+    _mm_madd_epi16(_mm_unpacklo_epi16(b2, b3), w23)
+  );
+
+  for(int i=0; i<3; i++) v[i]=_mm_srai_epi32(v[i], BICUBIC_SHIFT);
+
+  //align the rgb values of the four columns, v=(r0 g0 b0 r1 | g1 b1 r2 g2 |
+  //b2 r3 g3 b3), and interpolate the three channels together
+  __m128i c1=_mm_alignr_epi8(v[1], v[0], 12);
+  __m128i c2=_mm_alignr_epi8(v[2], v[1], 8);
+  __m128i c3=_mm_srli_si128(v[2], 4);
+
+  __m128i h=_mm_add_epi32(
+    _mm_add_epi32(
+      _mm_mullo_epi32(v[0], _mm_set1_epi32(wx[0])),
+      _mm_mullo_epi32(c1, _mm_set1_epi32(wx[1]))
+    ),
+    _mm_add_epi32(
+      _mm_mullo_epi32(c2, _mm_set1_epi32(wx[2])),
+      _mm_mullo_epi32(c3, _mm_set1_epi32(wx[3]))
+    )
+  );
+
+  //round, and clamp with the saturation of the packing
+  const int bits=2*BICUBIC_BITS-BICUBIC_SHIFT;
+  h=_mm_srai_epi32(_mm_add_epi32(h, _mm_set1_epi32(1<<(bits-1))), bits);
+  h=_mm_packus_epi16(_mm_packs_epi32(h, h), h);
+
+  int rgb=_mm_cvtsi128_si32(h);
+  memcpy(output, &rgb, 3);
+}
+#endif
+
+
+/**
+  *
+  * Compute the bicubic interpolation of a pixel in a frame of bytes
+  * It gives the same result with and without vector instructions
+  *
+**/
+inline void bicubic_interpolation(
+  unsigned char *input, //frame to be interpolated
+  unsigned char *output,//output pixel
+  float uu,             //x component of the vector field
+  float vv,             //y component of the vector field
+  int nx,               //width of the image
+  int ny,               //height of the image
+  int nz                //number of channels of the image
+)
+{
+  if(uu>nx || uu<-1 || vv>ny || vv<-1)
+  {
+    for(int k=0; k<nz; k++) output[k]=0;
+    return;
+  }
+
+  int px[4], py[4], wx[4], wy[4];
+  cubic_points(uu, nx, px);
+  cubic_points(vv, ny, py);
+  cubic_weights(uu-px[1], wx);
+  cubic_weights(vv-py[1], wy);
+
+#ifdef __SSE4_1__
+  if(nz==3 && uu>=1 && uu<nx-2 && vv>=1 && vv<ny-2)
+  {
+    bicubic_rgb(input, output, px[1], py[1], wx, wy, nx);
+    return;
+  }
+#endif
+
+  for(int k=0; k<nz; k++)
+  {
+    int v=0;
+    for(int i=0; i<4; i++)
+    {
+      int c=0;
+      for(int j=0; j<4; j++)
+        c+=wy[j]*input[(px[i]+nx*py[j])*nz+k];
+      v+=wx[i]*(c>>BICUBIC_SHIFT);
+    }
+    output[k]=fixed2byte(v);
+  }
+}
+
+
+/**
+  *
+  * Compute the bicubic interpolation of a frame of bytes from a parametric
+  * transform, without converting the frame to floats
+  *
+**/
+void bicubic_interpolation(
+  unsigned char *input, //frame to be warped
+  unsigned char *output,//warped output frame
+  float *params,        //x component of the vector field
+  int nparams,          //number of parameters of the transform
+  int nx,               //width of the image
+  int ny,               //height of the image
+  int nz                //number of channels of the image       
+)
+{
+  float matrix[9];
+  params2matrix(params, matrix, nparams);
+
+  #pragma omp parallel
+  {
+    float *xr=new float[nx];
+    float *yr=new float[nx];
+
+    #pragma omp for
+    for (int i=0; i<ny; i++)
     {
-      int p=i*nx+j;
-      float x, y;
-
-      //transform coordinates using the parametric model
-      project(j, i, params, x, y, nparams);
-      
-      //obtain the bicubic interpolation at position (uu, vv)
-      for(int k=0; k<nz; k++)
-        output[p*nz+k]=bicubic_interpolation(
-          input, x, y, nx, ny, nz, k
+      //transform the coordinates of the row using the parametric model
+      project_row(i, nx, matrix, xr, yr);
+
+      for (int j=0; j<nx; j++)
+        bicubic_interpolation(
+          input, &output[(i*nx+j)*nz], xr[j], yr[j], nx, ny, nz
         );
     }
+
+    delete []xr;
+    delete []yr;
+  }
 }
 
 
@@ -144,46 +450,60 @@ void bilinear_interpolation(
   int nz          //number of channels of the image       
 )
 {
-  #pragma omp parallel for
-  for(int i = 0; i < ny; i++)
-    for(int j = 0; j < nx; j++)
+  float matrix[9];
+  params2matrix(params, matrix, nparams);
+
+  #pragma omp parallel
+  {
+    float *xr=new float[nx];
+    float *yr=new float[nx];
+
+    #pragma omp for
+    for(int i = 0; i < ny; i++)
     {
-       float uu, vv;
+      //transform the coordinates of the row using the parametric model
+      project_row(i, nx, matrix, xr, yr);
 
-       //transform coordinates using the parametric model
-       project(j, i, params, uu, vv, nparams);
+      for(int j = 0; j < nx; j++)
+      {
+         float uu=xr[j], vv=yr[j];
  
-       if(uu<1 || uu>nx-2 || vv<1 || vv>ny-2)
-         for(int k=0; k<nz; k++)
-           output[(j+nx*i)*nz+k]=0;
-       else {
-         int sx=(uu<0)? -1: 1;
-         int sy=(vv<0)? -1: 1;
-         int x, y, dx, dy;
-
-         x =(int) uu;
-         y =(int) vv;
-         dx=(int) uu+sx;
-         dy=(int) vv+sy;
+         if(uu<1 || uu>nx-2 || vv<1 || vv>ny-2)
+           for(int k=0; k<nz; k++)
+             output[(j+nx*i)*nz+k]=0;
+         else {
+           int sx=(uu<0)? -1: 1;
+           int sy=(vv<0)? -1: 1;
+           int x, y, dx, dy;
+
+           x =(int) uu;
+           y =(int) vv;
+           dx=(int) uu+sx;
+           dy=(int) vv+sy;
          
-         for(int k=0; k<nz; k++){
-           float p1=input[(x +nx*y)*nz+k];
-           float p2=input[(dx+nx*y)*nz+k];
-           float p3=input[(x +nx*dy)*nz+k];
-           float p4=input[(dx+nx*dy)*nz+k];
+           for(int k=0; k<nz; k++){
+             float p1=input[(x +nx*y)*nz+k];
+             float p2=input[(dx+nx*y)*nz+k];
+             float p3=input[(x +nx*dy)*nz+k];
+             float p4=input[(dx+nx*dy)*nz+k];
 
-           float e1=((float) sx*(uu-x));
-           float E1=((float) 1.0-e1);
-           float e2=((float) sy*(vv-y));
-           float E2=((float) 1.0-e2);
+             float e1=((float) sx*(uu-x));
+             float E1=((float) 1.0-e1);
+             float e2=((float) sy*(vv-y));
+             float E2=((float) 1.0-e2);
 
-           float w1=E1*p1+e1*p2;
-           float w2=E1*p3+e1*p4;
+             float w1=E1*p1+e1*p2;
+             float w2=E1*p3+e1*p4;
 
-           output[(j+nx*i)*nz+k]=E2*w1+e2*w2;
+             output[(j+nx*i)*nz+k]=E2*w1+e2*w2;
+           }
          }
-       }
+      }
     }
+
+    delete []xr;
+    delete []yr;
+  }
 }
 
 
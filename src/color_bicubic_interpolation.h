@@ -46,6 +46,30 @@ void bicubic_interpolation(
 );
 
 
+//fixed point precision of the bicubic weights of the frames of bytes and
+//bits dropped between the vertical and the horizontal interpolation
+#define BICUBIC_BITS  11
+#define BICUBIC_SHIFT 7
+
+
+/**
+  *
+  * Compute the bicubic interpolation of a frame of bytes from a parametric
+  * transform, with fixed point arithmetic, writing the output frame of 
+  * bytes rounded and clamped to [0,255]
+  *
+**/
+void bicubic_interpolation(
+  unsigned char *input, //frame to be warped
+  unsigned char *output,//warped output frame
+  float *params,        //x component of the vector field
+  int nparams,          //number of parameters of the transform
+  int nx,               //width of the image
+  int ny,               //height of the image
+  int nz                //number of channels of the image       
+);
+
+
 /**
   *
   * Function to warp the image using bilinear interpolation
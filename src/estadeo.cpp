@@ -18,48 +18,103 @@
 #include <stdlib.h>
 
 
-estadeo::estadeo(int np, float sigm, int verb): 
-         Np(np), sigma(sigm), verbose(verb)
+estadeo::estadeo(int np, float sigm, int smooth, int verb): 
+         Np(np), sigma(sigm), smoothing(smooth), verbose(verb)
 {
   radius=obtain_radius();
-  N=(2*radius+1);
+  N=radius+1;
   Nf=1;
   fc=0;
  
-  //allocate motion transformations for the circular array
-  H  =new float[N*Np]; //motion transformations
-  Hc =new float[N*Np]; //composition of transformations
-  H_1=new float[N*Np]; //inverse transformations
+  //allocate the last motion transformation and its inverse
+  H  =new float[Np];
+  H_1=new float[Np];
 
   //introduce identity matrix for the first transform and its inverse
   for(int i=0; i<Np; i++) H[i]=H_1[i]=0;
+
+  //allocate the state of the recursive filters, starting at the first frame
+  S1=new float[Np];
+  S2=new float[Np];
+  for(int i=0; i<Np; i++) S1[i]=S2[i]=0;
+  
+  //two cascaded first order filters with the variance of the Gaussian:
+  //2*alpha/(1-alpha)^2=sigma^2
+  alpha=((sigma*sigma+1)-sqrt(2*sigma*sigma+1))/(sigma*sigma);
+
+  //the circular array and the Gaussian kernel are only needed by the 
+  //local matrix based smoothing
+  Hc=NULL; G=W=Wi=NULL;
+  if(smoothing==LOCAL_MATRIX_SMOOTHING)
+  {
+    //allocate the compositions of transformations for the circular array
+    Hc =new float[N*Np];
+  
+    //precompute the Gaussian kernel normalized with the sum of its 2*radius+1
+    //values, which are always used thanks to the symmetric boundaries
+    G=new double[radius+1];
+    double sum=0.0;
+    for(int d=0; d<=radius; d++)
+    {
+      G[d]=exp(-0.5*d*d/(sigma*sigma));
+      sum+=(d>0)? 2*G[d]: G[d];
+    }
+    for(int d=0; d<=radius; d++) G[d]/=sum;
+  
+    //the future frames are mirrored on the current one, so the weight of 
+    //the frame at distance d adds the one of the frame at distance d+1
+    W=new double[radius+1];
+    for(int d=0; d<radius; d++) W[d]=G[d]+G[d+1];
+    W[radius]=G[radius];
+  
+    //weights of the first frames, computed for each frame
+    Wi=new double[radius+1];
+  }
   
   //allocate last smooth transform
   Hs=new float[Np];
   
   //allocate last stabilizing transform
   Hp=new float[Np];
+  
+  //allocate the transform used by the background warping
+  Hw=new float[Np];
+  
+  //the pyramids are created with the first frames
+  ica=NULL;
 }
 
 estadeo::~estadeo()
 {
+  wait_warping();
+  
   delete []H;
   delete []Hc;
+  delete []S1;
+  delete []S2;
   delete []H_1;
+  delete []G;
+  delete []W;
+  delete []Wi;
   delete []Hs;
   delete []Hp;
+  delete []Hw;
+  delete ica;
 }
 
 /**
   *
   * Main function for Online Video Estabilization
   * Process a frame each time
+  * The warping of a frame runs in the background, overlapped with the 
+  * motion estimation of the next one, and the output order is preserved
   * 
 **/
 void estadeo::process_frame(
   float *I1,    //input previous image of video
   float *I2,    //input last image of video
-  float *Ic,    //input last color image to warp
+  unsigned char *Ic, //input last color frame to warp
+  unsigned char *Io, //output warped frame
   Timer &timer, //keep runtimes
   int   nx,     //number of columns 
   int   ny,     //number of rows
@@ -81,13 +136,29 @@ void estadeo::process_frame(
   if(verbose) timer.set_t2();
   motion_smoothing();
     
-  //step 3. Warp the incoming fame
+  //step 3. Warp the incoming fame once the previous one is finished
   if(verbose) timer.set_t3();
-  frame_warping(Ic, nx, ny, nz);
+  wait_warping();
+  
+  for(int i=0; i<Np; i++) Hw[i]=Hp[i];
+  warper=std::thread(
+    &estadeo::frame_warping, this, Ic, Io, Hw, nx, ny, nz
+  );
   if(verbose) timer.set_t4();
 }
 
 
+/**
+  *
+  * Function for waiting until the last frame is warped
+  *
+**/
+void estadeo::wait_warping()
+{
+  if(warper.joinable()) warper.join();
+}
+
+
 /**
   *
   * Function for estimating the transformation between two frames
@@ -100,6 +171,29 @@ void estadeo::compute_motion
   int   nx,  //number of columns
   int   ny   //number of rows
 )
+{
+  estimate_motion(ica, I1, I2, get_H(), Np, nx, ny);
+}
+
+
+/**
+  *
+  * Function for estimating the transformation between two frames
+  * The workspace is created with the first pair of frames; in the next
+  * calls, I1 must be the I2 of the previous call, so that its pyramid 
+  * and data are reused
+  *
+**/
+void estimate_motion
+(
+  ica_workspace *&ica, //pyramids of the last two frames
+  float *I1,    //first image
+  float *I2,    //second image
+  float *H,     //output transformation
+  int   nparams,//number of parameters
+  int   nx,     //number of columns
+  int   ny      //number of rows
+)
 {
   //parameters for the direct method
   float TOL=1E-3;
@@ -108,9 +202,22 @@ void estadeo::compute_motion
   int   cscale=(int)(log(((nx<ny)?nx:ny)/50)/log(2.)+1.5);
   int   fscale=cscale-1;
   
+  //the pyramid of the first image and its data are the ones of the 
+  //previous second image, so they are computed once per frame
+  if(ica==NULL)
+  {
+    ica=new ica_workspace(nx, ny, cscale, nparams);
+    create_pyramid(I1, ica->I1s, *ica);
+    create_templates(ica->I1s, ica->T1s, *ica, fscale, robust);
+  }
+  else ica->swap();
+  
+  create_pyramid(I2, ica->I2s, *ica);
+  create_templates(ica->I2s, ica->T2s, *ica, fscale, robust);
+  
   //motion estimation through direct methods
   pyramidal_inverse_compositional_algorithm(
-    I1, I2, get_H(), Np, nx, ny, cscale, fscale, TOL, robust, lambda
+    *ica, H, fscale, TOL, robust, lambda
   );
 }
 
@@ -118,96 +225,114 @@ void estadeo::compute_motion
 /**
   *
   * Function for online motion_smoothing
-  * using the local matrix based smoothing approach
-  * 
+  * using the selected strategy
   *
 **/
-
-//SE PUEDEN CALCULAR DE FORMA INCREMENTAL Hc (con una sola H_1)
 void estadeo::motion_smoothing()
 {
+  if(smoothing==RECURSIVE_SMOOTHING) 
+    recursive_smoothing();
+  else 
+    local_matrix_smoothing();
+}
+
+
+/**
+  *
+  * Function for online motion_smoothing
+  * using the local matrix based smoothing approach
+  * The compositions of the previous frames with the current one are 
+  * updated incrementally, so only the current frame is smoothed
+  *
+**/
+void estadeo::local_matrix_smoothing()
+{
+  //current frame
+  int i=Nf-1;
+  
   //adapt current radius
   int rad=radius; 
   if(rad>=Nf) rad=Nf-1;
 
-  //obtain current size of circular array  
-  int n=N;   
-  if(n>Nf) n=Nf;
-
   //compute inverse transform
-  inverse_transform(&(H[fc*Np]), &(H_1[fc*Np]), Np);
+  inverse_transform(H, H_1, Np);
 
-  //recompute the stabilization for past frames using the circular buffer
-  for(int i=Nf-rad; i<Nf; i++)
+  //update the backward transformations with the last inverse,
+  //Hc_j=H_1_{j+1} o ... o H_1_i; the composition can be done in place
+  for(int j=i-rad; j<i-1; j++)
   {
-    //compute backward transformations
-    int f=i%n;     //current frame in circular buffer
-    int l=(i-1)%n; //previous frame in circular buffer
-    
-    for(int j=0;j<Np;j++) 
-      Hc[l*Np+j]=H_1[f*Np+j];
-      
-    for(int j=i-2; j>=std::max(i-rad,0); j--)
-    {
-      int l1=(j+1)%n;
-      int l2=j%n;
-      compose_transform(&(H_1[l1*Np]), &(Hc[l1*Np]), &(Hc[l2*Np]), Np);
-    }
+    float *Hj=&(Hc[(j%N)*Np]);
+    compose_transform(Hj, H_1, Hj, Np);
+  }
+  
+  //the previous frame only needs the last inverse
+  int l=(i-1)%N;
+  for(int j=0;j<Np;j++) 
+    Hc[l*Np+j]=H_1[j];
 
-    //introduce the identity matrix in the current frame
-    for(int j=0;j<Np;j++) Hc[f*Np+j]=0;
-
-    //compute forward transformations
-    if(i<Nf-1)
-    { 
-      int r=(i+1)%n;
-      
-      for(int j=0;j<Np;j++) 
-        Hc[r*Np+j]=H[r*Np+j];
-        
-      for(int j=i+2;j<Nf;j++)  //QUITE el <=
-      {
-        int r1=j%n;
-        int r2=(j-1)%n;
-        compose_transform(&(H[r1*Np]), &(Hc[r2*Np]), &(Hc[r1*Np]), Np);  
-      }
-    }
+  //introduce the identity matrix in the current frame
+  for(int j=0;j<Np;j++) 
+    Hc[fc*Np+j]=0;
+
+  //convolve with a discrete Gaussian kernel
+  gaussian(i);
+
+  //compute inverse transformations 
+  inverse_transform(Hs, Hp, Np);
+}
 
-    //convolve with a discrete Gaussian kernel
-    gaussian(i, radius, n);
 
-    //compute inverse transformations 
-    inverse_transform(Hs, Hp, Np);
+/**
+  *
+  * Function for online motion_smoothing
+  * using two cascaded first order recursive filters
+  * The filters are causal and only keep their last output, expressed 
+  * with respect to the current frame, so their cost does not depend on 
+  * sigma; the smoothed trajectory is delayed with respect to the one of 
+  * the Gaussian window
+  *
+**/
+void estadeo::recursive_smoothing()
+{
+  //compute inverse transform
+  inverse_transform(H, H_1, Np);
+  
+  //express the outputs of the filters with respect to the current frame
+  compose_transform(S1, H_1, S1, Np);
+  compose_transform(S2, H_1, S2, Np);
+  
+  //the current frame is the identity matrix
+  for(int p=0; p<Np; p++)
+  {
+    S1[p]=alpha*S1[p];
+    S2[p]=alpha*S2[p]+(1-alpha)*S1[p];
   }
+  
+  for(int p=0; p<Np; p++) Hs[p]=S2[p];
+
+  //compute inverse transformations 
+  inverse_transform(Hs, Hp, Np);
 }
 
 
 /**
   *
   * Function for online warping the last frame of the video
+  * It interpolates the frame of bytes directly, without float frames
   *
 **/
 void estadeo::frame_warping
 (
-  float *I, //frame to be warped
+  unsigned char *I,  //frame to be warped
+  unsigned char *Io, //output warped frame
+  float *H, //stabilizing transform
   int   nx, //number of columns   
   int   ny, //number of rows
   int   nz  //number of channels
 )
 {
-  int size=nx*ny*nz;
-
-  float *I2=new float[nx*ny*nz];
-
   //warp the image
-  bicubic_interpolation(I, I2, Hp, Np, nx, ny, nz);
-  //bilinear_interpolation(I, I2, Hp, Np, nx, ny, nz);
-
-  //copy warped image
-  for(int j=0; j<size; j++)
-    I[j]=I2[j];
-
-  delete []I2;
+  bicubic_interpolation(I, Io, H, Np, nx, ny, nz);
 }
 
 
@@ -219,7 +344,7 @@ void estadeo::frame_warping
 **/
 float *estadeo::get_H()
 {
-  return &H[fc*Np];
+  return H;
 }
 
 
@@ -230,66 +355,51 @@ float *estadeo::get_H()
 **/
 float *estadeo::get_smooth_H()
 {
-  float *H_1=new float[Np];
-  float *Htmp=new float[Np];
+  float H_1[MAX_NPARAMS], Htmp[MAX_NPARAMS];
 
   inverse_transform(Hp, H_1, Np);
   compose_transform(get_H(), Hp, Htmp, Np);
   compose_transform(H_1, Htmp, Hs, Np);
   
-  delete []H_1;
-  delete []Htmp;
-  
   return Hs;
 }
 
 
-//Gaussian convolution
-void estadeo::gaussian(int i, int rad, int n)
+//Gaussian convolution of the current frame
+void estadeo::gaussian(int i)
 {
-  //Gaussian convolution in each parameter separately
-  for(int p=0; p<Np; p++)
+  double *w=W;  //weights of the past frames
+  int    n=radius; //number of past frames
+  
+  //at the beginning, the positions outside the available frames are 
+  //mirrored until they fall on one of them
+  if(i<radius)
   {
-    double average=0.0;
-    double sum=0.0;
+    w=Wi;
+    n=i;
+    for(int k=0; k<=i; k++) w[k]=0.0;
     
-    int j=i-rad;
-    
-    //left Neumann boundary conditions
-    for(; j<=0; j++)
-    {
-      //apply Gaussian filter using the circular buffer
-      double v=Hc[-j*Np+p];
-      double norm=0.5*(j-i)*(j-i)/(sigma*sigma);
-      double gauss=exp(-norm);
-      average+=gauss*v;
-      sum+=gauss;
-    }
-     
-    int t=(i+rad>=Nf)? Nf-1: i+rad;
-    for(; j<=t; j++)
-    {
-      //apply Gaussian filter using the circular buffer
-      double v=Hc[(j%n)*Np+p];
-      double norm=0.5*(j-i)*(j-i)/(sigma*sigma);
-      double gauss=exp(-norm);
-      average+=gauss*v;
-      sum+=gauss;
-    }
-
-    //right Neumann boundary conditions
-    for(; j<=i+rad; j++)
+    for(int j=i-radius; j<=i+radius; j++)
     {
-      //apply Gaussian filter using the circular buffer
-      int l=(2*Nf-1-j)%n;
-      double v=Hc[l*Np+p];
-      double norm=0.5*(j-i)*(j-i)/(sigma*sigma);
-      double gauss=exp(-norm);
-      average+=gauss*v;
-      sum+=gauss;
+      int k=j;
+      while(k<0 || k>i)
+        k=(k>i)? 2*i+1-k: -k;
+      w[i-k]+=G[abs(j-i)];
     }
+  }
 
-    Hs[p]=(float) (average/sum);
+  //weighted average of the transformations in the circular buffer, 
+  //with the same weights for every parameter
+  double average[MAX_NPARAMS];
+  for(int p=0; p<Np; p++) average[p]=0.0;
+  
+  for(int k=0; k<=n; k++)
+  {
+    float *Hk=&(Hc[((i-k)%N)*Np]);
+    for(int p=0; p<Np; p++)
+      average[p]+=w[k]*Hk[p];
   }
-}
 
+  for(int p=0; p<Np; p++) 
+    Hs[p]=(float) average[p];
+}
@@ -3,6 +3,14 @@
 
 #include "utils.h"
 
+#include <thread>
+
+class ica_workspace;
+
+//motion smoothing strategies
+#define LOCAL_MATRIX_SMOOTHING 0 //Gaussian window centered at each frame
+#define RECURSIVE_SMOOTHING    1 //causal recursive filter
+
 
 /**
  *
@@ -16,26 +24,36 @@ class estadeo {
     estadeo(
       int   np,    //number of parameters of the transformations
       float sigm,  //Gaussian standard deviation for smoothing
+      int   smooth,//motion smoothing strategy
       int   verb   //switch on verbose mode
     );
     
     ~estadeo();
     
+    //the color frame is warped in the background into the frame of the 
+    //caller: it is ready after the next call to process_frame or to 
+    //wait_warping
+    //I1 must be the I2 of the previous call
     void process_frame(
       float *I1,    //input previous grayscale image 
       float *I2,    //input last grayscale image
-      float *Ic,    //input last color image to warp
+      unsigned char *Ic, //input last color frame to warp
+      unsigned char *Io, //output warped frame
       Timer &timer, //manage runtimes
       int   nx,     //number of columns 
       int   ny,     //number of rows
       int   nz      //number of channels
     );
     
+    void wait_warping();
+    
     float *get_H();
 
     float *get_smooth_H();
     
     int obtain_radius(){return (int)3*sigma;}
+    
+    int get_nparams(){return Np;}
 
   
   private:
@@ -49,8 +67,14 @@ class estadeo {
 
     void motion_smoothing();
     
+    void local_matrix_smoothing();
+
+    void recursive_smoothing();
+    
     void frame_warping(
-      float *I, //frame to be warped
+      unsigned char *I,  //frame to be warped
+      unsigned char *Io, //output warped frame
+      float *H, //stabilizing transform
       int   nx, //number of columns   
       int   ny, //number of rows
       int   nz  //number of channels
@@ -58,25 +82,59 @@ class estadeo {
 
     
     //function for Gaussian convolution
-    void gaussian(int i, int rad, int n);
+    void gaussian(int i);
     
   private:
   
     int   Nf;      //number of frames
     int   Np;      //number of parameters in the transformation
     float sigma;   //Gaussian standard deviation 
+    int   smoothing; //motion smoothing strategy
     int   radius;  //radius of the Gaussian convolution
+    double *G;     //normalized Gaussian kernel from 0 to radius
+    double *W;     //weights of the past frames, adding the mirrored ones
+    double *Wi;    //weights during the first radius frames
     float *Hs;     //last smoothing transform
     float *Hp;     //last stabilizing transform
     int   verbose; //verbose mode
     
+    //variables for warping in the background
+    std::thread warper; //thread warping the last frame
+    float *Hw;          //stabilizing transform of the frame being warped
+    
+    //pyramids of the last two frames for the motion estimation
+    ica_workspace *ica;
+    
+    float *H;   //last motion transformation
+    float *H_1; //inverse of the last motion transformation
+    
+    //variables for the recursive smoothing
+    float alpha; //decay of the filters
+    float *S1;   //output of the first filter
+    float *S2;   //output of the second filter
+    
     //variables for the circular array
     int   N;    //circular array size
     int   fc;   //current frame position
-    float *H;   //original matrix transformation
-    float *Hc;  //composition of transformations
-    float *H_1; //inverse transformations
+    float *Hc;  //compositions of transformations up to the current frame
 };
 
 
+/**
+ *
+ * Function for estimating the transformation between two frames 
+ * reusing the pyramid of the previous frame
+ *
+**/
+void estimate_motion(
+  ica_workspace *&ica, //pyramids of the last two frames
+  float *I1,    //first image
+  float *I2,    //second image
+  float *H,     //output transformation
+  int   nparams,//number of parameters
+  int   nx,     //number of columns
+  int   ny      //number of rows
+);
+
+
 #endif
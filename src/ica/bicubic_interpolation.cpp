@@ -126,6 +126,9 @@ void bicubic_interpolation(
   int ny          //height of the image 
 )
 {
+  float m[9];
+  params2matrix(params, m, nparams);
+
   #pragma omp parallel for
   for (unsigned int i=0; i<p.size(); i++)
   {
@@ -134,7 +137,7 @@ void bicubic_interpolation(
     float y1=(int)(p[i]/nx);
 
     //transform coordinates using the parametric model
-    project(x1, y1, params, x, y, nparams);
+    project_point(x1, y1, m, x, y);
     
     //obtain the bicubic interpolation at position (x, y)
     output[i]=bicubic_interpolation(input, x, y, nx, ny);
@@ -156,18 +159,28 @@ void bicubic_interpolation(
   int   ny        //height of the image 
 )
 {
-  #pragma omp parallel for
-  for(int i=0; i<ny; i++)
-    for(int j=0; j<nx; j++)
+  float m[9];
+  params2matrix(params, m, nparams);
+
+  #pragma omp parallel
+  {
+    float *x=new float[nx];
+    float *y=new float[nx];
+
+    #pragma omp for
+    for(int i=0; i<ny; i++)
     {
-      float x, y;
+      //transform the coordinates of the row using the parametric model
+      project_row(i, nx, m, x, y);
 
-      //transform coordinates using the parametric model
-      project(j, i, params, x, y, nparams);
-      
-      //obtain the bicubic interpolation at position (x, y)
-      output[i*nx+j]=bicubic_interpolation(input, x, y, nx, ny);
+      //obtain the bicubic interpolation at positions (x, y)
+      for(int j=0; j<nx; j++)
+        output[i*nx+j]=bicubic_interpolation(input, x[j], y[j], nx, ny);
     }
+
+    delete []x;
+    delete []y;
+  }
 }
 
 
@@ -186,6 +199,9 @@ void bilinear_interpolation(
   int ny          //height of the image
 )
 {
+  float m[9];
+  params2matrix(params, m, nparams);
+
   #pragma omp parallel for
   for (unsigned int i=0; i<p.size(); i++)
   {
@@ -194,7 +210,7 @@ void bilinear_interpolation(
     float uu, vv;
 
     //transform coordinates using the parametric model
-    project(x1, y1, params, uu, vv, nparams);
+    project_point(x1, y1, m, uu, vv);
 
     if(uu<1 || uu>nx-2 || vv<1 || vv>ny-2)
       output[i]=999999.9;
@@ -27,6 +27,10 @@
 #include <stdio.h>
 #include <vector>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "bicubic_interpolation.h"
 #include "inverse_compositional_algorithm.h"
 #include "matrix.h"
@@ -67,83 +71,131 @@ inline float rhop(
  *
  *  Function to compute DI^t*J
  *  from the gradient of the image and the Jacobian
+ *  The Jacobian is evaluated at each point with the parametrizations 
+ *  of the jacobian function, without storing it
+ *  The values of each parameter are stored contiguously, so that the 
+ *  iterations can process several points at once
  *
  */
 void steepest_descent_images
 (
   float *Ix,   //x derivate of the image
   float *Iy,   //y derivate of the image
-  float *J,    //Jacobian matrix
-  float *DIJ,  //output DI^t*J
+  vector<int> &x, //points
+  float *DIJ,  //output DI^t*J, one plane of N values per parameter
   int nparams, //number of parameters
-  int N        //number of points
+  int nx       //number of columns
 )
 {
-  #pragma omp parallel for
-  for(unsigned int p=0; p<(unsigned int)N; p++)
-    for(int n=0; n<nparams; n++)
-      DIJ[p*nparams+n]=Ix[p]*J[2*p*nparams+n]+
-                       Iy[p]*J[2*p*nparams+n+nparams];
+  int N=x.size();
+  switch(nparams) 
+  {
+    default: case TRANSLATION_TRANSFORM:  //p=(tx, ty) 
+      #pragma omp parallel for
+      for(int p=0; p<N; p++)
+      {
+        float *D=&DIJ[p];
+        D[0]=Ix[p]; D[N]=Iy[p];
+      }
+      break;
+    case EUCLIDEAN_TRANSFORM:  //p=(tx, ty, tita)
+      #pragma omp parallel for
+      for(int p=0; p<N; p++)
+      {
+        float *D=&DIJ[p];
+        float x1=x[p]%nx;
+        float y1=(int)(x[p]/nx);
+        D[0]=Ix[p]; D[N]=Iy[p]; D[2*N]=Ix[p]*-y1+Iy[p]*x1;
+      }
+      break;
+    case SIMILARITY_TRANSFORM: //p=(tx, ty, a, b)
+      #pragma omp parallel for
+      for(int p=0; p<N; p++)
+      {
+        float *D=&DIJ[p];
+        float x1=x[p]%nx;
+        float y1=(int)(x[p]/nx);
+        D[0]=Ix[p]; D[N]=Iy[p]; 
+        D[2*N]=Ix[p]*x1+Iy[p]*y1; D[3*N]=Ix[p]*-y1+Iy[p]*x1;
+      }
+      break;
+    case AFFINITY_TRANSFORM:  //p=(tx, ty, a00, a01, a10, a11)
+      #pragma omp parallel for
+      for(int p=0; p<N; p++)
+      {
+        float *D=&DIJ[p];
+        float x1=x[p]%nx;
+        float y1=(int)(x[p]/nx);
+        D[0]=Ix[p];    D[N]=Iy[p]; 
+        D[2*N]=Ix[p]*x1; D[3*N]=Ix[p]*y1; D[4*N]=Iy[p]*x1; D[5*N]=Iy[p]*y1;
+      }
+      break;    
+    case HOMOGRAPHY_TRANSFORM: //p=(h00, h01,..., h21)
+      #pragma omp parallel for
+      for(int p=0; p<N; p++)
+      {
+        float *D=&DIJ[p];
+        int x1=x[p]%nx;
+        int y1=(int)(x[p]/nx);
+        float xx=-x1*x1, xy=-x1*y1, yy=-y1*y1;
+        D[0]=Ix[p]*x1; D[N]=Ix[p]*y1; D[2*N]=Ix[p];
+        D[3*N]=Iy[p]*x1; D[4*N]=Iy[p]*y1; D[5*N]=Iy[p];
+        D[6*N]=Ix[p]*xx+Iy[p]*xy; D[7*N]=Ix[p]*xy+Iy[p]*yy;
+      }
+      break;
+  }
 }
 
 /**
  *
  *  Function to compute the Hessian matrix
  *  the Hessian is equal to DIJ^t*DIJ
+ *  The points are split in blocks whose partial sums are added at the end
  *
  */
 void hessian
 (
   float *DIJ,  //the steepest descent image
   float *H,    //output Hessian matrix
+  float *P,    //partial sums of each block
   int nparams, //number of parameters
   int N        //number of values
 ) 
 {
-  //initialize the hessian to zero
-  #pragma omp parallel for
-  for(int k=0; k<nparams*nparams; k++)
-    H[k] = 0;
- 
-  //calculate the hessian in a neighbor window
-  #pragma omp parallel for
-  for(int k=0; k<nparams; k++)
-    for(int l=0; l<nparams; l++)
-      for(int i=0; i<N; i++)
-	     H[k*nparams+l]+=DIJ[i*nparams+k]*DIJ[i*nparams+l];
-}
-
-
-/**
- *
- *  Function to compute the Hessian matrix with robust error functions
- *  the Hessian is equal to rho'*DIJ^t*DIJ
- *
- */
-void hessian
-(
-  float *DIJ,  //the steepest descent image
-  float *rho,  //robust function
-  float *H,    //output Hessian matrix
-  int nparams, //number of parameters
-  int N        //number of values
-) 
-{
-  //initialize the hessian to zero  
-  #pragma omp parallel for
-  for(int k=0; k<nparams*nparams; k++)
-    H[k]=0;
+  int nblocks=(N+ICA_BLOCK-1)/ICA_BLOCK;
+  int np2=nparams*nparams;
 
-  //calculate the hessian in a neighbor window
+  //calculate the upper triangle of each block
   #pragma omp parallel for
+  for(int j=0; j<nblocks; j++)
+  {
+    int i0=j*ICA_BLOCK;
+    int i1=(i0+ICA_BLOCK<N)? i0+ICA_BLOCK: N;
+    float *Hj=&P[j*np2];
+    for(int k=0; k<nparams; k++)
+      for(int l=k; l<nparams; l++)
+      {
+        float *Dk=&DIJ[k*N];
+        float *Dl=&DIJ[l*N];
+        float sum=0;
+        for(int i=i0; i<i1; i++)
+          sum+=Dk[i]*Dl[i];
+        Hj[k*nparams+l]=sum;
+      }
+  }
+  
+  //add the blocks in order and copy the upper triangle to the lower one
   for(int k=0; k<nparams; k++)
-    for(int l=0; l<nparams; l++)
-      for(int i=0; i<N; i++)
-	     H[k*nparams+l]+=rho[i]*DIJ[i*nparams+k]*DIJ[i*nparams+l];
+    for(int l=k; l<nparams; l++)
+    {
+      float sum=0;
+      for(int j=0; j<nblocks; j++)
+        sum+=P[j*np2+k*nparams+l];
+      H[k*nparams+l]=H[l*nparams+k]=sum;
+    }
 }
 
 
-
 /**
  *
  *  Function to compute the inverse of the Hessian
@@ -162,96 +214,314 @@ void inverse_hessian
 }
 
 
+#ifdef __AVX2__
 /**
  *
- *  Function to compute I2(W(x;p))-I1(x)
+ *  Horizontal sum of the eight values of a register
  *
  */
-void difference_image
-(
-  float *I,  //first image I1(x)
-  float *Iw, //second warped image I2(x'(x;p)) 
-  float *DI, //output difference array
-  vector<int> &x //points
-) 
+inline float sum8(__m256 v)
 {
-  #pragma omp parallel for
-  for(unsigned int i=0; i<x.size(); i++)
-    DI[i]=Iw[i]-I[x[i]];
+  __m128 s=_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s=_mm_add_ps(s, _mm_movehl_ps(s, s));
+  s=_mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
 }
+#endif
 
 
 /**
  *
- *  Function to store the values of p'((I2(x'(x;p))-I1(x))²)
+ *  Function to compute the normal equations of a block of points in a 
+ *  single pass: it warps I2 at each point with bilinear interpolation, 
+ *  computes the difference I2(x'(x;p))-I1(x) and its robust weight, and 
+ *  accumulates b=Sum(rho'*DIJ^t*DI) and the upper triangle of 
+ *  H=Sum(rho'*DIJ^t*DIJ)
+ *  If H is NULL, it computes the quadratic version: b=Sum(DIJ^t*DI)
+ *  The points warped outside the image take the value 999999.9, as in 
+ *  the bilinear_interpolation function
+ *  It is instantiated for each number of parameters, so that the loops of 
+ *  the Hessian are unrolled and the accumulators are kept in registers
  *
  */
-void robust_error_function
+template <int NPARAMS>
+void block_normal_equations
 (
-  float *DI,   //input difference array
-  float *rho,  //output robust function
-  float lambda,//threshold used in the robust functions
-  int   N      //number of values
+  float *I1,      //first image I1(x)
+  float *I2,      //second image
+  vector<int> &x, //points
+  float *DIJ,     //the steepest descent images
+  float *m,       //matrix of the transform
+  float *b,       //output independent vector
+  float *H,       //output Hessian matrix (upper triangle)
+  float lambda,   //threshold used in the robust functions
+  int   nx,       //number of columns
+  int   ny,       //number of rows
+  int   i0,       //first point of the block
+  int   i1        //last point of the block (not included)
 )
-{ 
-  #pragma omp parallel for
-  for(int i=0;i<N;i++)
+{
+  const int nparams=NPARAMS;
+  const int np2=nparams*nparams;
+  int N=x.size();
+
+  //local sums, that do not alias the steepest descent images
+  float bs[NPARAMS], Hs[NPARAMS*NPARAMS];
+  for(int k=0; k<nparams; k++) bs[k]=0;
+  for(int k=0; k<np2; k++) Hs[k]=0;
+
+  int i=i0;
+
+#ifdef __AVX2__
+  __m256 bv[NPARAMS], Hv[NPARAMS*NPARAMS];
+  for(int k=0; k<nparams; k++) bv[k]=_mm256_setzero_ps();
+  for(int k=0; k<np2; k++) Hv[k]=_mm256_setzero_ps();
+
+  const __m256i nxv=_mm256_set1_epi32(nx);
+  const __m256i one=_mm256_set1_epi32(1);
+  const __m256  inx=_mm256_set1_ps(1.0f/nx);
+  const __m256  onef=_mm256_set1_ps(1.0f);
+  const __m256  xmax=_mm256_set1_ps(nx-2);
+  const __m256  ymax=_mm256_set1_ps(ny-2);
+  const __m256  out=_mm256_set1_ps(999999.9f);
+  const __m256  l2=_mm256_set1_ps(lambda*lambda);
+  
+  for(; i+8<=i1; i+=8)
   {
-    float norm=DI[i]*DI[i];
-    rho[i]=rhop(norm,lambda);
+    //row and column of the points, correcting the division in floats
+    __m256i xi=_mm256_loadu_si256((__m256i *)&x[i]);
+    __m256i yi=_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(xi),inx));
+    __m256i ci=_mm256_sub_epi32(xi, _mm256_mullo_epi32(yi, nxv));
+    __m256i lo=_mm256_cmpgt_epi32(_mm256_setzero_si256(), ci);
+    yi=_mm256_add_epi32(yi, lo);
+    ci=_mm256_add_epi32(ci, _mm256_and_si256(lo, nxv));
+    __m256i hi=_mm256_cmpgt_epi32(ci, _mm256_sub_epi32(nxv, one));
+    yi=_mm256_sub_epi32(yi, hi);
+    ci=_mm256_sub_epi32(ci, _mm256_and_si256(hi, nxv));
+    __m256 x1=_mm256_cvtepi32_ps(ci);
+    __m256 y1=_mm256_cvtepi32_ps(yi);
+
+    //transform the coordinates
+    __m256 d=_mm256_add_ps(_mm256_add_ps(
+      _mm256_mul_ps(_mm256_set1_ps(m[6]), x1),
+      _mm256_mul_ps(_mm256_set1_ps(m[7]), y1)), _mm256_set1_ps(m[8]));
+    __m256 uu=_mm256_div_ps(_mm256_add_ps(_mm256_add_ps(
+      _mm256_mul_ps(_mm256_set1_ps(m[0]), x1),
+      _mm256_mul_ps(_mm256_set1_ps(m[1]), y1)), _mm256_set1_ps(m[2])), d);
+    __m256 vv=_mm256_div_ps(_mm256_add_ps(_mm256_add_ps(
+      _mm256_mul_ps(_mm256_set1_ps(m[3]), x1),
+      _mm256_mul_ps(_mm256_set1_ps(m[4]), y1)), _mm256_set1_ps(m[5])), d);
+
+    //points inside the image; the others read the first pixel
+    __m256 in=_mm256_and_ps(
+      _mm256_and_ps(_mm256_cmp_ps(uu, onef, _CMP_GE_OQ),
+                    _mm256_cmp_ps(uu, xmax, _CMP_LE_OQ)),
+      _mm256_and_ps(_mm256_cmp_ps(vv, onef, _CMP_GE_OQ),
+                    _mm256_cmp_ps(vv, ymax, _CMP_LE_OQ)));
+    __m256 uf=_mm256_floor_ps(_mm256_and_ps(uu, in));
+    __m256 vf=_mm256_floor_ps(_mm256_and_ps(vv, in));
+    __m256i pi=_mm256_add_epi32(_mm256_cvttps_epi32(uf), 
+      _mm256_mullo_epi32(_mm256_cvttps_epi32(vf), nxv));
+
+    //bilinear interpolation
+    __m256 p1=_mm256_i32gather_ps(I2, pi, 4);
+    __m256 p2=_mm256_i32gather_ps(I2, _mm256_add_epi32(pi, one), 4);
+    __m256 p3=_mm256_i32gather_ps(I2, _mm256_add_epi32(pi, nxv), 4);
+    __m256 p4=_mm256_i32gather_ps(I2, 
+      _mm256_add_epi32(pi, _mm256_add_epi32(nxv, one)), 4);
+    __m256 e1=_mm256_sub_ps(uu, uf);
+    __m256 E1=_mm256_sub_ps(onef, e1);
+    __m256 e2=_mm256_sub_ps(vv, vf);
+    __m256 E2=_mm256_sub_ps(onef, e2);
+    __m256 w1=_mm256_add_ps(_mm256_mul_ps(E1, p1), _mm256_mul_ps(e1, p2));
+    __m256 w2=_mm256_add_ps(_mm256_mul_ps(E1, p3), _mm256_mul_ps(e1, p4));
+    __m256 Iw=_mm256_add_ps(_mm256_mul_ps(E2, w1), _mm256_mul_ps(e2, w2));
+    Iw=_mm256_blendv_ps(out, Iw, in);
+    
+    //difference image
+    __m256 DI=_mm256_sub_ps(Iw, _mm256_i32gather_ps(I1, xi, 4));
+
+    if(H==NULL)
+      for(int k=0; k<nparams; k++)
+      {
+        __m256 D=_mm256_loadu_ps(&DIJ[k*N+i]);
+        bv[k]=_mm256_add_ps(bv[k], _mm256_mul_ps(D, DI));
+      }
+    else
+    {
+      //Lorentzian weights
+      __m256 rho=_mm256_div_ps(onef, 
+        _mm256_add_ps(l2, _mm256_mul_ps(DI, DI)));
+      for(int k=0; k<nparams; k++)
+      {
+        __m256 rD=_mm256_mul_ps(rho, _mm256_loadu_ps(&DIJ[k*N+i]));
+        bv[k]=_mm256_add_ps(bv[k], _mm256_mul_ps(rD, DI));
+        for(int l=k; l<nparams; l++)
+          Hv[k*nparams+l]=_mm256_add_ps(Hv[k*nparams+l], 
+            _mm256_mul_ps(rD, _mm256_loadu_ps(&DIJ[l*N+i])));
+      }
+    }
+  }
+
+  for(int k=0; k<nparams; k++) bs[k]=sum8(bv[k]);
+  if(H!=NULL) 
+    for(int k=0; k<nparams; k++)
+      for(int l=k; l<nparams; l++)
+        Hs[k*nparams+l]=sum8(Hv[k*nparams+l]);
+#endif
+
+  //remaining points, or all of them without vector instructions
+  for(; i<i1; i++)
+  {
+    int x1=x[i]%nx;
+    int y1=(int)(x[i]/nx);
+    
+    //transform the coordinates
+    float d =m[6]*x1+m[7]*y1+m[8];
+    float uu=(m[0]*x1+m[1]*y1+m[2])/d;
+    float vv=(m[3]*x1+m[4]*y1+m[5])/d;
+    
+    //bilinear interpolation
+    float Iw;
+    if(uu<1 || uu>nx-2 || vv<1 || vv>ny-2)
+      Iw=999999.9;
+    else 
+    {
+      int xx=(int) uu;
+      int yy=(int) vv;
+      float *I=&I2[xx+nx*yy];
+      float e1=uu-xx;
+      float E1=1-e1;
+      float e2=vv-yy;
+      float E2=1-e2;
+      float w1=E1*I[0]+e1*I[1];
+      float w2=E1*I[nx]+e1*I[nx+1];
+      Iw=E2*w1+e2*w2;
+    }
+
+    //difference image
+    float DI=Iw-I1[x[i]];
+    
+    if(H==NULL)
+      for(int k=0; k<nparams; k++)
+        bs[k]+=DIJ[k*N+i]*DI;
+    else
+    {
+      float rho=rhop(DI*DI, lambda);
+      for(int k=0; k<nparams; k++)
+      {
+        float rD=rho*DIJ[k*N+i];
+        bs[k]+=rD*DI;
+        for(int l=k; l<nparams; l++)
+          Hs[k*nparams+l]+=rD*DIJ[l*N+i];
+      }
+    }
   }
+
+  for(int k=0; k<nparams; k++) b[k]=bs[k];
+  if(H!=NULL) for(int k=0; k<np2; k++) H[k]=Hs[k];
 }
 
 
+//normal equations of a block of points for a number of parameters
+typedef void (*block_kernel)(
+  float *, float *, vector<int> &, float *, float *, float *, float *, 
+  float, int, int, int, int
+);
+
+
 /**
  *
- *  Function to compute b=Sum(DIJ^t * DI)
+ *  Function to select the instance of block_normal_equations for the
+ *  number of parameters of the transform
  *
  */
-void independent_vector
+block_kernel select_block_kernel
 (
-  float *DIJ, //the steepest descent image
-  float *DI,  //I2(x'(x;p))-I1(x) 
-  float *b,   //output independent vector
-  int   nparams, //number of parameters
-  int   N     //number of columns
+  int nparams //number of parameters
 )
 {
-  //initialize the vector to zero
-  for(int k=0; k<nparams; k++)
-    b[k]=0;
-
-  #pragma omp parallel for
-  for(int k=0; k<nparams; k++)
-    for(int i=0; i<N; i++)
-      b[k]+=DIJ[i*nparams+k]*DI[i];
+  switch(nparams) 
+  {
+    default: case TRANSLATION_TRANSFORM: 
+      return block_normal_equations<TRANSLATION_TRANSFORM>;
+    case EUCLIDEAN_TRANSFORM: 
+      return block_normal_equations<EUCLIDEAN_TRANSFORM>;
+    case SIMILARITY_TRANSFORM: 
+      return block_normal_equations<SIMILARITY_TRANSFORM>;
+    case AFFINITY_TRANSFORM: 
+      return block_normal_equations<AFFINITY_TRANSFORM>;
+    case HOMOGRAPHY_TRANSFORM: 
+      return block_normal_equations<HOMOGRAPHY_TRANSFORM>;
+  }
 }
 
 
 /**
  *
- *  Function to compute b=Sum(rho'*DIJ^t * DI)
- *  with robust error functions
+ *  Function to compute the normal equations of one iteration
+ *  The points are split in blocks whose partial sums are added at the 
+ *  end, always in the same order, so the result does not depend on the 
+ *  number of threads
+ *  If H is NULL, it computes the quadratic version
  *
  */
-void independent_vector
+void normal_equations
 (
-  float *DIJ,    //the steepest descent image
-  float *DI,     //I2(x'(x;p))-I1(x) 
-  float *rho,    //robust function
-  float *b,      //output independent vector
-  int   nparams, //number of parameters
-  int   N        //number of values
+  float *I1,      //first image I1(x)
+  float *I2,      //second image
+  vector<int> &x, //points
+  float *DIJ,     //the steepest descent images
+  float *p,       //parameters of the transform
+  float *b,       //output independent vector
+  float *H,       //output Hessian matrix
+  float *P,       //partial sums of each block
+  float lambda,   //threshold used in the robust functions
+  int   nparams,  //number of parameters
+  int   nx,       //number of columns
+  int   ny        //number of rows
 )
 {
-  //initialize the vector to zero
-  for(int k=0; k<nparams; k++)
-    b[k]=0;
+  int N=x.size();
+  int nblocks=(N+ICA_BLOCK-1)/ICA_BLOCK;
+  int np2=nparams*nparams;
+  int size=nparams+np2;
+  float m[9];
 
+  //the transform is evaluated as a matrix in all the parametrizations
+  params2matrix(p, m, nparams);
+  block_kernel kernel=select_block_kernel(nparams);
+
+  //compute the partial sums of each block
   #pragma omp parallel for
+  for(int j=0; j<nblocks; j++)
+  {
+    int i0=j*ICA_BLOCK;
+    int i1=(i0+ICA_BLOCK<N)? i0+ICA_BLOCK: N;
+    kernel(
+      I1, I2, x, DIJ, m, &P[j*size], (H==NULL)? NULL: &P[j*size+nparams],
+      lambda, nx, ny, i0, i1
+    );
+  }
+  
+  //add the blocks in order
   for(int k=0; k<nparams; k++)
-    for(int i=0; i<N; i++)
-      b[k]+=rho[i]*DIJ[i*nparams+k]*DI[i];
+  {
+    float sum=0;
+    for(int j=0; j<nblocks; j++) sum+=P[j*size+k];
+    b[k]=sum;
+  }
+
+  if(H!=NULL)
+    for(int k=0; k<nparams; k++)
+      for(int l=k; l<nparams; l++)
+      {
+        float sum=0;
+        for(int j=0; j<nblocks; j++) sum+=P[j*size+nparams+k*nparams+l];
+        
+        //copy the upper triangle of the Hessian to the lower one
+        H[k*nparams+l]=H[l*nparams+k]=sum;
+      }
 }
 
 
@@ -308,68 +578,77 @@ void select_points(
 
 /**
   *
-  *  Inverse compositional algorithm
-  *  Quadratic version - L2 norm
-  * 
+  *  Precompute the data of the first image that does not change during
+  *  the iterations: the steepest descent images and, in the quadratic 
+  *  version, the inverse Hessian
   *
 **/
-void inverse_compositional_algorithm(
-  float *I1,   //first image
-  float *I2,   //second image
-  float *p,    //parameters of the transform (output)
-  int nparams, //number of parameters of the transform
-  float TOL,   //Tolerance used for the convergence in the iterations
-  int   nx,    //number of columns
-  int   ny     //number of rows
+void compute_template(
+  float *I1,        //first image
+  vector<int> &x,   //selected points
+  ica_template &t,  //output data of the first image
+  ica_workspace &w, //auxiliary memory
+  int   nparams,    //number of parameters of the transform
+  int   nx,         //number of columns
+  int   robust      //robust error function
 )
 {
-  //find corner points
-  vector<int> x;
-  select_points(x, nx, ny);
-  
-  int N=x.size();
-  int size2=N*nparams;       //size of the image with transform parameters
-  int size3=nparams*nparams; //size for the Hessian
-  int size4=2*N*nparams; 
-  
-  float *Iw=new float[N];      //warp of the second image/
-  float *DI=new float[N];      //error image (I2(w)-I1)
-  float *DIJ=new float[size2]; //steepest descent images
-  float *dp=new float[nparams];//incremental solution
-  float *b=new float[nparams]; //steepest descent images
-  float *J=new float[size4];   //jacobian matrix for all points
-  float *H=new float[size3];   //Hessian matrix
-  float *H_1=new float[size3]; //inverse Hessian matrix
-  float *Ix=new float[N];      //x derivate of the first image
-  float *Iy=new float[N];      //y derivate of the first image
+  int N=x.size();              //number of points
+  int size3=nparams*nparams;   //size for the Hessian
 
-  //Evaluate the gradient of I1
-  gradient(I1, Ix, Iy, x, nx);
+  t.DIJ.resize(N*nparams);
 
-  //Evaluate the Jacobian
-  jacobian(J, x, nparams, nx);
+  //Evaluate the gradient of I1
+  gradient(I1, w.Ix, w.Iy, x, nx);
 
   //Compute the steepest descent images
-  steepest_descent_images(Ix, Iy, J, DIJ, nparams, N);
+  steepest_descent_images(w.Ix, w.Iy, x, t.DIJ.data(), nparams, nx);
+
+  //Compute the inverse Hessian, which is constant in the L2 norm
+  if(robust==QUADRATIC)
+  {
+    t.H_1.resize(size3);
+    hessian(t.DIJ.data(), w.H, w.P, nparams, N);
+    inverse_hessian(w.H, t.H_1.data(), nparams);
+  }
+}
 
-  //Compute the Hessian matrix
-  hessian(DIJ, H, nparams, N);
-  inverse_hessian(H, H_1, nparams);
+
+/**
+  *
+  *  Inverse compositional algorithm
+  *  Quadratic version - L2 norm
+  *  It uses the precomputed data of the first image
+  *
+**/
+void inverse_compositional_algorithm(
+  float *I1,        //first image
+  float *I2,        //second image
+  vector<int> &x,   //selected points
+  ica_template &t,  //precomputed data of the first image
+  ica_workspace &w, //auxiliary memory
+  float *p,         //parameters of the transform (output)
+  int nparams,      //number of parameters of the transform
+  float TOL,        //Tolerance used for the convergence in the iterations
+  int   nx,         //number of columns
+  int   ny          //number of rows
+)
+{
+  float *dp=w.dp;              //incremental solution
+  float *b=w.b;                //steepest descent images
+  float *DIJ=t.DIJ.data();     //steepest descent images
+  float *H_1=t.H_1.data();     //inverse Hessian matrix
 
   //Iterate
   float error=1E10;
   int niter=0;
 
   do{     
-    //Warp image I2
-    //bicubic_interpolation(I2, x, Iw, p, nparams, nx, ny);
-    bilinear_interpolation(I2, x, Iw, p, nparams, nx, ny);
-
-    //Compute the error image (I1-I2w)
-    difference_image(I1, Iw, DI, x);
-    
-    //Compute the independent vector
-    independent_vector(DIJ, DI, b, nparams, N);
+    //Warp image I2, compute the error image (I2w-I1) and 
+    //the independent vector in a single pass
+    normal_equations(
+      I1, I2, x, DIJ, p, b, NULL, w.P, 0, nparams, nx, ny
+    );
 
     //Solve equation and compute increment of the motion 
     error=parametric_solve(H_1, b, dp, nparams);
@@ -380,68 +659,62 @@ void inverse_compositional_algorithm(
     niter++;    
   }
   while(error>TOL && niter<MAX_ITER);
-
-  delete []Iw;
-  delete []DI;
-  delete []DIJ;
-  delete []dp;
-  delete []b;
-  delete []J;
-  delete []H;
-  delete []H_1;
-  delete []Ix;
-  delete []Iy;
 }
 
 
+/**
+  *
+  *  Inverse compositional algorithm
+  *  Quadratic version - L2 norm
+  * 
+  *
+**/
+void inverse_compositional_algorithm(
+  float *I1,   //first image
+  float *I2,   //second image
+  float *p,    //parameters of the transform (output)
+  int nparams, //number of parameters of the transform
+  float TOL,   //Tolerance used for the convergence in the iterations
+  int   nx,    //number of columns
+  int   ny     //number of rows
+)
+{
+  ica_workspace w(nx, ny, 1, nparams);
+  
+  compute_template(I1, w.xs[0], w.T1s[0], w, nparams, nx, QUADRATIC);
+  inverse_compositional_algorithm(
+    I1, I2, w.xs[0], w.T1s[0], w, p, nparams, TOL, nx, ny
+  );
+}
+
 
 /**
   *
   *  Inverse compositional algorithm 
   *  Version with robust error functions
+  *  It uses the precomputed data of the first image
   * 
 **/
 void robust_inverse_compositional_algorithm(
-  float *I1,     //first image
-  float *I2,     //second image
-  float *p,      //parameters of the transform (output)
-  int   nparams, //number of parameters of the transform
-  float TOL,     //Tolerance used for the convergence in the iterations
-  float lambda,  //parameter of robust error function
-  int   nx,      //number of columns
-  int   ny       //number of rows
+  float *I1,        //first image
+  float *I2,        //second image
+  vector<int> &x,   //selected points
+  ica_template &t,  //precomputed data of the first image
+  ica_workspace &w, //auxiliary memory
+  float *p,         //parameters of the transform (output)
+  int   nparams,    //number of parameters of the transform
+  float TOL,        //Tolerance used for the convergence in the iterations
+  float lambda,     //parameter of robust error function
+  int   nx,         //number of columns
+  int   ny          //number of rows
 )
 {  
-  //find reference points
-  vector<int> x;
-  select_points(x, nx, ny);      
-
-  int N=x.size();              //number of corner points
-  int size2=N*nparams;         //size of the image with transform parameters
-  int size3=nparams*nparams;   //size for the Hessian
-  int size4=2*N*nparams; 
-  
-  float *Iw=new float[N];      //warp of the second image/
-  float *DI=new float[N];      //error image (I2(w)-I1)
-  float *DIJ=new float[size2]; //steepest descent images
-  float *dp=new float[nparams];//incremental solution
-  float *b=new float[nparams]; //steepest descent images
-  float *J=new float[size4];   //jacobian matrix for all points
-  float *H=new float[size3];   //Hessian matrix
-  float *H_1=new float[size3]; //inverse Hessian matrix
-  float *Ix=new float[N];      //x derivate of the first image
-  float *Iy=new float[N];      //y derivate of the first image
-  float *rho=new float[N];     //robust function  
-
-  //Evaluate the gradient of I1
-  gradient(I1, Ix, Iy, x, nx);
-
-  //Evaluate the Jacobian
-  jacobian(J, x, nparams, nx);
+  float *dp=w.dp;              //incremental solution
+  float *b=w.b;                //steepest descent images
+  float *H=w.H;                //Hessian matrix
+  float *H_1=w.H_1;            //inverse Hessian matrix
+  float *DIJ=t.DIJ.data();     //steepest descent images
 
-  //Compute the steepest descent images
-  steepest_descent_images(Ix, Iy, J, DIJ, nparams, N);
-  
   //Iterate
   float error=1E10;
   int niter=0;
@@ -451,26 +724,18 @@ void robust_inverse_compositional_algorithm(
   else lambda_it=LAMBDA_0;
   
   do{     
-    //Warp image I2
-    //bicubic_interpolation(I2, x, Iw, p, nparams, nx, ny);
-    bilinear_interpolation(I2, x, Iw, p, nparams, nx, ny);
-
-    //Compute the error image (I1-I2w)
-    difference_image(I1, Iw, DI, x);
+    //Warp image I2, compute the error image (I2w-I1), the robust 
+    //function, the independent vector and the Hessian in a single pass
+    normal_equations(
+      I1, I2, x, DIJ, p, b, H, w.P, lambda_it, nparams, nx, ny
+    );
 
-    //compute robustifiction function
-    robust_error_function(DI, rho, lambda_it, N);
     if(lambda<=0 && lambda_it>LAMBDA_N) 
     {
       lambda_it*=LAMBDA_RATIO;
       if(lambda_it<LAMBDA_N) lambda_it=LAMBDA_N;
     }
 
-    //Compute the independent vector
-    independent_vector(DIJ, DI, rho, b, nparams, N);
-
-    //Compute the Hessian matrix
-    hessian(DIJ, rho, H, nparams, N);
     inverse_hessian(H, H_1, nparams);
 
     //Solve equation and compute increment of the motion 
@@ -482,87 +747,209 @@ void robust_inverse_compositional_algorithm(
     niter++;    
   }
   while(error>TOL && niter<MAX_ITER);
+}
+
+
+/**
+  *
+  *  Inverse compositional algorithm 
+  *  Version with robust error functions
+  * 
+**/
+void robust_inverse_compositional_algorithm(
+  float *I1,     //first image
+  float *I2,     //second image
+  float *p,      //parameters of the transform (output)
+  int   nparams, //number of parameters of the transform
+  float TOL,     //Tolerance used for the convergence in the iterations
+  float lambda,  //parameter of robust error function
+  int   nx,      //number of columns
+  int   ny       //number of rows
+)
+{  
+  ica_workspace w(nx, ny, 1, nparams);
+
+  compute_template(I1, w.xs[0], w.T1s[0], w, nparams, nx, LORENTZIAN);
+  robust_inverse_compositional_algorithm(
+    I1, I2, w.xs[0], w.T1s[0], w, p, nparams, TOL, lambda, nx, ny
+  );
+}
 
-  delete []Iw;
-  delete []DI;
-  delete []DIJ;
+
+/**
+  *
+  *  Allocate the pyramids and the auxiliary memory for 
+  *  images of the given size
+  *
+**/
+ica_workspace::ica_workspace(
+  int nxx,    //image width
+  int nyy,    //image height
+  int nscales,//number of scales
+  int nparams //number of parameters
+): nscales(nscales), nparams(nparams)
+{
+  nx =new int[nscales];
+  ny =new int[nscales];
+  I1s=new float*[nscales];
+  I2s=new float*[nscales];
+  T1s=new ica_template[nscales];
+  T2s=new ica_template[nscales];
+  xs =new vector<int>[nscales];
+  ps =new float*[nscales];
+
+  nx[0]=nxx;
+  ny[0]=nyy;
+  for(int s=1; s<nscales; s++)
+    zoom_size(nx[s-1], ny[s-1], nx[s], ny[s]);
+    
+  int N=0;
+  for(int s=0; s<nscales; s++)
+  {
+    I1s[s]=new float[nx[s]*ny[s]];
+    I2s[s]=new float[nx[s]*ny[s]];
+    ps[s] =new float[nparams];
+    
+    //the points only depend on the size of the scale
+    select_points(xs[s], nx[s], ny[s]);
+    
+    int n=xs[s].size();
+    if(n>N) N=n;
+    
+    T1s[s].DIJ.resize(n*nparams);
+    T2s[s].DIJ.resize(n*nparams);
+  }
+  
+  //allocate the memory of the iterations for the largest number of points
+  Ix =new float[N];
+  Iy =new float[N];
+  dp =new float[nparams];
+  b  =new float[nparams];
+  H  =new float[nparams*nparams];
+  H_1=new float[nparams*nparams];
+  Is =new float[nxx*nyy];
+  It =new float[nxx*nyy];
+  P  =new float[((N+ICA_BLOCK-1)/ICA_BLOCK)*(nparams+nparams*nparams)];
+}
+
+ica_workspace::~ica_workspace()
+{
+  for(int s=0; s<nscales; s++)
+  {
+    delete []I1s[s];
+    delete []I2s[s];
+    delete []ps[s];
+  }
+  delete []I1s;
+  delete []I2s;
+  delete []T1s;
+  delete []T2s;
+  delete []xs;
+  delete []ps;
+  delete []nx;
+  delete []ny;
+  delete []Ix;
+  delete []Iy;
   delete []dp;
   delete []b;
-  delete []J;
   delete []H;
   delete []H_1;
-  delete []Ix;
-  delete []Iy;
-  delete []rho;
+  delete []Is;
+  delete []It;
+  delete []P;
+}
+
+
+/**
+  *
+  *  The pyramid of the second image becomes the first one,
+  *  together with its precomputed data
+  *
+**/
+void ica_workspace::swap()
+{
+  float **tmp=I1s;
+  I1s=I2s;
+  I2s=tmp;
+  
+  ica_template *tmpt=T1s;
+  T1s=T2s;
+  T2s=tmpt;
+}
+
+
+/**
+  *
+  *  Function to create the pyramid of an image
+  *
+**/
+void create_pyramid(
+  float *I,        //input image
+  float **Is,      //output pyramid
+  ica_workspace &w //workspace with the size of each scale
+)
+{
+  int size=w.nx[0]*w.ny[0];
+  
+  //copy the input image
+  #pragma omp parallel for
+  for(int i=0;i<size;i++)
+    Is[0][i]=I[i];
+
+  //zoom the images from the previous scale
+  for(int s=1; s<w.nscales; s++)
+    zoom_out(Is[s-1], Is[s], w.nx[s-1], w.ny[s-1], w.Is, w.It);
+}
+
+
+/**
+  *
+  *  Function to precompute the data of the inverse compositional
+  *  algorithm at the scales of a pyramid where the motion is estimated
+  *
+**/
+void create_templates(
+  float **Is,        //input pyramid
+  ica_template *Ts,  //output data at each scale
+  ica_workspace &w,  //workspace with the size of each scale
+  int   fscale,      //finest scale 
+  int   robust       //robust error function
+)
+{
+  for(int s=(fscale>1)? fscale-1: 0; s<w.nscales; s++)
+    compute_template(
+      Is[s], w.xs[s], Ts[s], w, w.nparams, w.nx[s], robust
+    );
 }
 
 
 /**
   *
   *  Multiscale approach for computing the optical flow
+  *  The pyramids of both images and the data of the first one 
+  *  must be created in the workspace
   *
 **/
 void pyramidal_inverse_compositional_algorithm(
-    float *I1,     //first image
-    float *I2,     //second image
+    ica_workspace &w, //pyramids of the images
     float *p,      //parameters of the transform
-    int   nparams, //number of parameters
-    int   nxx,     //image width
-    int   nyy,     //image height
-    int   cscale,  //coarsest scale
     int   fscale,  //finest scale 
     float TOL,     //stopping criterion threshold
     int   robust,  //robust error function
     float lambda   //parameter of robust error function
 )
 {
-    int size=nxx*nyy;
-
-    float **I1s=new float*[cscale];
-    float **I2s=new float*[cscale];
-    float **ps =new float*[cscale];
-
-    int *nx=new int[cscale];
-    int *ny=new int[cscale];
-
-    I1s[0]=new float[size];
-    I2s[0]=new float[size];
-
-    //copy the input images
-    #pragma omp parallel for
-    for(int i=0;i<size;i++)
-    {
-      I1s[0][i]=I1[i];
-      I2s[0][i]=I2[i];
-    }
-
-    ps[0]=p;
-    nx[0]=nxx;
-    ny[0]=nyy;
-
-    //initialization of the transformation parameters at the finest scale
-    for(int i=0; i<nparams; i++)
-      p[i]=0.0;
-
-    //create the scales
-    for(int s=1; s<cscale; s++)
-    {
-      zoom_size(nx[s-1], ny[s-1], nx[s], ny[s]);
-
-      const int size=nx[s]*ny[s];
-
-      I1s[s]=new float[size];
-      I2s[s]=new float[size];
-      ps[s] =new float[nparams];
-      
+    int cscale=w.nscales;
+    int nparams=w.nparams;
+    int *nx=w.nx;
+    int *ny=w.ny;
+    float **ps=w.ps;
+
+    //initialization of the transformation parameters
+    for(int s=0; s<cscale; s++)
       for(int i=0; i<nparams; i++)
         ps[s][i]=0.0;
 
-      //zoom the images from the previous scale
-      zoom_out(I1s[s-1], I1s[s], nx[s-1], ny[s-1]);
-      zoom_out(I2s[s-1], I2s[s], nx[s-1], ny[s-1]);
-    }  
-
     //pyramidal approach for computing the transformation
     for(int s=cscale-1; s>=0; s--)
     {
@@ -572,11 +959,12 @@ void pyramidal_inverse_compositional_algorithm(
         //incremental refinement for this scale
         if(robust==QUADRATIC)
           inverse_compositional_algorithm(
-            I1s[s], I2s[s], ps[s], nparams, TOL, nx[s], ny[s]
+            w.I1s[s], w.I2s[s], w.xs[s], w.T1s[s], w, ps[s], nparams, TOL, 
+            nx[s], ny[s]
           );
         else
           robust_inverse_compositional_algorithm(
-            I1s[s], I2s[s], ps[s], nparams, TOL, 
+            w.I1s[s], w.I2s[s], w.xs[s], w.T1s[s], w, ps[s], nparams, TOL, 
             lambda, nx[s], ny[s]
           );
       }
@@ -587,19 +975,39 @@ void pyramidal_inverse_compositional_algorithm(
           ps[s], ps[s-1], nparams, nx[s], ny[s], nx[s-1], ny[s-1]
         );
     }
+    
+    for(int i=0; i<nparams; i++)
+      p[i]=ps[0][i];
+}
 
-    //delete allocated memory
-    delete []I1s[0];
-    delete []I2s[0];
-    for(int i=1; i<cscale; i++)
-    {
-      delete []I1s[i];
-      delete []I2s[i];
-      delete []ps [i];
-    }
-    delete []I1s;
-    delete []I2s;
-    delete []ps;
-    delete []nx;
-    delete []ny;
+
+/**
+  *
+  *  Multiscale approach for computing the optical flow
+  *
+**/
+void pyramidal_inverse_compositional_algorithm(
+    float *I1,     //first image
+    float *I2,     //second image
+    float *p,      //parameters of the transform
+    int   nparams, //number of parameters
+    int   nxx,     //image width
+    int   nyy,     //image height
+    int   cscale,  //coarsest scale
+    int   fscale,  //finest scale 
+    float TOL,     //stopping criterion threshold
+    int   robust,  //robust error function
+    float lambda   //parameter of robust error function
+)
+{
+    ica_workspace w(nxx, nyy, cscale, nparams);
+
+    //create the scales
+    create_pyramid(I1, w.I1s, w);
+    create_pyramid(I2, w.I2s, w);
+    create_templates(w.I1s, w.T1s, w, fscale, robust);
+
+    pyramidal_inverse_compositional_algorithm(
+      w, p, fscale, TOL, robust, lambda
+    );
 }
@@ -36,6 +36,39 @@
 #define LAMBDA_N 5
 #define LAMBDA_RATIO 0.90
 
+//number of points of the partial sums of the normal equations
+#define ICA_BLOCK 1024
+
+#include <vector>
+
+class ica_workspace;
+
+/**
+  *
+  *  Data of the first image that does not change during the iterations
+  *
+**/
+struct ica_template {
+  std::vector<float> DIJ; //steepest descent images
+  std::vector<float> H_1; //inverse Hessian (only for the quadratic version)
+};
+
+
+/**
+  *
+  *  Function to precompute the data of the first image
+  *
+**/
+void compute_template(
+  float *I1,       //first image
+  std::vector<int> &x, //selected points
+  ica_template &t, //output data of the first image
+  ica_workspace &w,//auxiliary memory
+  int   nparams,   //number of parameters of the transform
+  int   nx,        //number of columns
+  int   robust     //robust error function
+);
+
 
 /**
   *
@@ -49,9 +82,30 @@ void inverse_compositional_algorithm(
   float *I2,     //second image
   float *p,      //parameters of the transform (output)
   int   nparams, //number of parameters of the transform
+  float TOL,     //Tolerance used for the convergence in the iterations
   int   nx,      //number of columns of the image
-  int   ny,      //number of rows of the image
-  float TOL      //Tolerance used for the convergence in the iterations
+  int   ny       //number of rows of the image
+);
+
+
+/**
+  *
+  *  Inverse compositional algorithm
+  *  Quadratic version - L2 norm
+  *  It uses the precomputed data of the first image
+  *
+**/
+void inverse_compositional_algorithm(
+  float *I1,       //first image
+  float *I2,       //second image
+  std::vector<int> &x, //selected points
+  ica_template &t, //precomputed data of the first image
+  ica_workspace &w,//auxiliary memory
+  float *p,        //parameters of the transform (output)
+  int   nparams,   //number of parameters of the transform
+  float TOL,       //Tolerance used for the convergence in the iterations
+  int   nx,        //number of columns of the image
+  int   ny         //number of rows of the image
 );
 
 
@@ -66,11 +120,129 @@ void robust_inverse_compositional_algorithm(
   float *I2,    //second image
   float *p,     //parameters of the transform (output)
   int   nparams,//number of parameters of the transform
-  int   nx,     //number of columns of the image
-  int   ny,     //number of rows of the image
   float TOL,    //Tolerance used for the convergence in the iterations
-  int   robust, //robust error function
-  float lambda  //parameter of robust error function
+  float lambda, //parameter of robust error function
+  int   nx,     //number of columns of the image
+  int   ny      //number of rows of the image
+);
+
+
+/**
+  *
+  *  Inverse compositional algorithm 
+  *  Version with robust error functions
+  *  It uses the precomputed data of the first image
+  * 
+**/
+void robust_inverse_compositional_algorithm(
+  float *I1,       //first image
+  float *I2,       //second image
+  std::vector<int> &x, //selected points
+  ica_template &t, //precomputed data of the first image
+  ica_workspace &w,//auxiliary memory
+  float *p,        //parameters of the transform (output)
+  int   nparams,   //number of parameters of the transform
+  float TOL,       //Tolerance used for the convergence in the iterations
+  float lambda,    //parameter of robust error function
+  int   nx,        //number of columns of the image
+  int   ny         //number of rows of the image
+);
+
+
+/**
+  *
+  *  Data of the inverse compositional algorithm that is kept between 
+  *  successive calls: the pyramids of the first and second images,
+  *  their precomputed data, the selected points at each scale and the
+  *  auxiliary memory of the iterations, so that no memory is allocated
+  *  while estimating the motion
+  *
+**/
+class ica_workspace {
+
+  public:
+  
+    ica_workspace(
+      int nxx,    //image width
+      int nyy,    //image height
+      int nscales,//number of scales
+      int nparams //number of parameters
+    );
+    
+    ~ica_workspace();
+    
+    //the workspace owns its buffers, so it cannot be copied
+    ica_workspace(const ica_workspace &)=delete;
+    ica_workspace &operator=(const ica_workspace &)=delete;
+    
+    //the second image becomes the first one
+    void swap();
+
+    int   nscales; //number of scales
+    int   nparams; //number of parameters
+    int   *nx;     //width of each scale
+    int   *ny;     //height of each scale
+    float **I1s;   //pyramid of the first image
+    float **I2s;   //pyramid of the second image
+    ica_template *T1s; //data of the first image at each scale
+    ica_template *T2s; //data of the second image at each scale
+    std::vector<int> *xs; //selected points at each scale
+    float **ps;    //parameters at each scale
+    
+    //auxiliary memory of the iterations
+    float *Ix;     //gradient of the first image
+    float *Iy;
+    float *dp;     //incremental solution
+    float *b;      //independent vector
+    float *H;      //Hessian matrix
+    float *H_1;    //inverse Hessian matrix
+    float *Is;     //auxiliary images for the zoom
+    float *It;
+    float *P;      //partial sums of the normal equations of each block
+};
+
+
+/**
+  *
+  *  Function to create the pyramid of an image
+  *
+**/
+void create_pyramid(
+  float *I,        //input image
+  float **Is,      //output pyramid
+  ica_workspace &w //workspace with the size of each scale
+);
+
+
+/**
+  *
+  *  Function to precompute the data of the inverse compositional
+  *  algorithm at the scales of a pyramid where the motion is estimated
+  *
+**/
+void create_templates(
+  float **Is,        //input pyramid
+  ica_template *Ts,  //output data at each scale
+  ica_workspace &w,  //workspace with the size of each scale
+  int   fscale,      //finest scale 
+  int   robust       //robust error function
+);
+
+
+/**
+  *
+  *  Multiscale approach for computing the optical flow
+  *  The pyramids of both images and the data of the first one 
+  *  must be created in the workspace
+  *
+**/
+void pyramidal_inverse_compositional_algorithm(
+    ica_workspace &w, //pyramids of the images
+    float *p,      //parameters of the transform
+    int   fscale,  //finest scale 
+    float TOL,     //stopping criterion threshold
+    int   robust,  //robust error function
+    float lambda   //parameter of robust error function
 );
 
 
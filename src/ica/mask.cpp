@@ -105,35 +105,20 @@ void gradient(
 
 /**
  *
- * Convolution with a Gaussian
+ * Compute the coefficients of a normalized 1D Gaussian kernel
+ * It returns the size of the kernel
  *
  */
-void gaussian (
-  float *I,     //input image
-  float *Is,    //output image
-  int xdim,     //image width
-  int ydim,     //image height
+int gaussian_kernel(
+  double *B,    //output kernel with precision*sigma+1 values
   float sigma,  //Gaussian sigma
   int precision //defines the size of the window
 )
 {
-  int i, j, k;
-
-  if(sigma<=0 || precision<=0){
-    #pragma omp parallel for
-    for(int i=0; i<xdim*ydim; i++) Is[i] = I[i];
-    return;
-  }
-  
   double den  = 2*sigma*sigma;
   int    size = (int) (precision*sigma)+1;
-  int    bdx  = xdim+size;
-  int    bdy  = ydim+size;
 
-  if(size>xdim) return;
-        
   //compute the coefficients of the 1D convolution kernel
-  double *B = new double[size];
   for (int i=0; i<size; i++)
     B[i] = 1/(sigma*sqrt(2.0*3.1415926))*exp(-i*i/den);
 
@@ -149,61 +134,105 @@ void gaussian (
 
   for (int i=0; i<size; i++)
     B[i] /= norm;
+    
+  return size;
+}
 
-#pragma omp parallel for
-  //convolution of each line of the input image
-  for (k=0; k<ydim; k++)
+
+/**
+ *
+ * Convolution of a line with a symmetric kernel
+ * using reflecting boundary conditions
+ *
+ */
+void convolve_line(
+  float  *I,     //input line
+  float  *Is,    //output line
+  int    stride, //distance between consecutive values
+  double *B,     //convolution kernel
+  int    size,   //size of the kernel
+  int    n       //number of values
+)
+{
+  for (int i=0; i<n; i++)
   {
-    double *R = new double[size+xdim+size];
-    for (i=size; i<bdx; i++)
-      R[i] = I[k*xdim+i-size];
-
-    //reflecting boundary conditions
-    for (i=0, j=bdx; i<size; i++, j++)
-    {
-      R[i] = I[k*xdim+size-i];
-      R[j] = I[k*xdim+xdim-i-1];
-    }
-
-    for (i=size; i<bdx; i++)
-    {
-      double sum = B[0]*R[i];
-
-      for (int j = 1; j < size; j++)
-        sum += B[j]*(R[i-j]+R[i+j]);
-
-      Is[k*xdim+i-size] = sum;
-    }
-    delete []R;
+    double sum = B[0]*I[i*stride];
+
+    if(i>=size && i<n-size)
+      for (int j=1; j<size; j++)
+        sum += B[j]*((double)I[(i-j)*stride]+(double)I[(i+j)*stride]);
+    else
+      for (int j=1; j<size; j++)
+      {
+        int l=i-j, r=i+j;
+        if(l<0)  l=-l;
+        if(r>=n) r=2*n-1-r;
+        sum += B[j]*((double)I[l*stride]+(double)I[r*stride]);
+      }
+
+    Is[i*stride] = sum;
   }
+}
+
+
+/**
+ *
+ * Convolution with a precomputed Gaussian kernel
+ * It does not allocate memory
+ *
+ */
+void gaussian (
+  float  *I,    //input image
+  float  *Is,   //output image
+  float  *It,   //auxiliary image of the same size
+  double *B,    //Gaussian kernel
+  int    size,  //size of the kernel
+  int    xdim,  //image width
+  int    ydim   //image height
+)
+{
+  //convolution of each line of the input image
+  #pragma omp parallel for
+  for (int k=0; k<ydim; k++)
+    convolve_line(&I[k*xdim], &It[k*xdim], 1, B, size, xdim);
 
-#pragma omp parallel for
   //convolution of each column of the input image
-  for (k=0; k<xdim; k++)
-  {
-    double *T = new double[size+ydim+size];
-    for (i=size; i<bdy; i++)
-      T[i] = Is[(i-size)*xdim+k];
-           
-    //reflecting boundary conditions
-    for (i=0, j=bdy; i<size; i++, j++)
-    {
-      T[i] = Is[(size-i)*xdim+k];
-      T[j] = Is[(ydim-i-1)*xdim+k];
-    }
-      
-    for (i=size; i<bdy; i++)
-    {
-      double sum = B[0]*T[i];
-
-      for (j=1; j<size; j++)
-        sum += B[j]*(T[i-j]+T[i+j]);
-
-      Is[(i-size)*xdim+k] = sum;
-    }
-    delete[]T;
+  #pragma omp parallel for
+  for (int k=0; k<xdim; k++)
+    convolve_line(&It[k], &Is[k], xdim, B, size, ydim);
+}
+
+
+/**
+ *
+ * Convolution with a Gaussian
+ *
+ */
+void gaussian (
+  float *I,     //input image
+  float *Is,    //output image
+  int xdim,     //image width
+  int ydim,     //image height
+  float sigma,  //Gaussian sigma
+  int precision //defines the size of the window
+)
+{
+  if(sigma<=0 || precision<=0){
+    #pragma omp parallel for
+    for(int i=0; i<xdim*ydim; i++) Is[i] = I[i];
+    return;
   }
+  
+  int size = (int) (precision*sigma)+1;
 
-  delete[]B;
-}
+  if(size>xdim) return;
+        
+  double *B  = new double[size];
+  float  *It = new float[xdim*ydim];
 
+  gaussian_kernel(B, sigma, precision);
+  gaussian(I, Is, It, B, size, xdim, ydim);
+
+  delete []B;
+  delete []It;
+}
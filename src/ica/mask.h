@@ -42,6 +42,37 @@ void gradient(
 
 
 
+/**
+ *
+ * Compute the coefficients of a normalized 1D Gaussian kernel
+ * It returns the size of the kernel
+ *
+ */
+int gaussian_kernel(
+  double *B,    //output kernel with precision*sigma+1 values
+  float sigma,  //Gaussian sigma
+  int precision //defines the size of the window
+);
+
+
+/**
+ *
+ * Convolution with a precomputed Gaussian kernel
+ * It does not allocate memory
+ *
+ */
+void
+gaussian (
+  float  *I,    //input image
+  float  *Is,   //output image
+  float  *It,   //auxiliary image of the same size
+  double *B,    //Gaussian kernel
+  int    size,  //size of the kernel
+  int    xdim,  //image width
+  int    ydim   //image height
+);
+
+
 /**
  *
  * Convolution with a Gaussian
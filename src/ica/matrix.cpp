@@ -12,6 +12,9 @@
 
 using namespace std;
 
+//largest matrix inverted without dynamic memory
+#define MAX_STACK_INVERSE 8
+
 
 //Multiplication of a square matrix and a vector
 void Axb(
@@ -33,15 +36,14 @@ void Axb(
 
 
 //Function to compute the inverse of a matrix
-//through Gaussian elimination
-int inverse(
-  float *A,   //input matrix
-  float *A_1, //output matrix
-  int   N     //matrix dimension
+//through Gaussian elimination using an auxiliary array of 2*N*N values
+static int inverse(
+  float  *A,   //input matrix
+  float  *A_1, //output matrix
+  int    N,    //matrix dimension
+  double *T    //auxiliary array
 ) 
 {
-  double *T=new double[2*N*N];
-
   double max, mul;
   int i, j, i_max, k;
 
@@ -63,10 +65,8 @@ int inverse(
        } 
     }
 
-    if(max<1e-30){ 
-      delete []T;
+    if(max<1e-30) 
       return -1;
-    }
     if(i_max>i){
       for(k=0;k<2*N;k++){
         double tmp=T[i*2*N+k];
@@ -81,10 +81,8 @@ int inverse(
     }
   }
   
-  if(fabs(T[(N-1)*2*N+N-1])<1e-30){ 
-      delete []T;
+  if(fabs(T[(N-1)*2*N+N-1])<1e-30)
       return -1;
-  }
       
   for(i=N-1;i>0;i--){
     for(j=i-1;j>=0;j--){
@@ -100,9 +98,30 @@ int inverse(
     for(j=0;j<N;j++)
       A_1[i*N+j]=T[i*2*N+j+N];
 
+  return 0;   
+}
+
+
+//Function to compute the inverse of a matrix
+//through Gaussian elimination
+int inverse(
+  float *A,   //input matrix
+  float *A_1, //output matrix
+  int   N     //matrix dimension
+) 
+{
+  //small matrices, like the Hessians of the transformations, 
+  //do not need dynamic memory
+  double Ts[2*MAX_STACK_INVERSE*MAX_STACK_INVERSE];
+
+  if(N<=MAX_STACK_INVERSE) 
+    return inverse(A, A_1, N, Ts);
+  
+  double *T=new double[2*N*N];
+  int result=inverse(A, A_1, N, T);
   delete []T;
   
-  return 0;   
+  return result;
 }
 
 
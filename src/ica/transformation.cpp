@@ -246,6 +246,47 @@ void project
   }
 }
 
+
+/**
+ *
+ *  Function to transform the points (0,y),...,(nx-1,y) of a row through 
+ *  the matrix of a parametric model (params2matrix)
+ *  The coordinates of the affine models change by constant increments 
+ *  along the row, and the homographies also step the denominator, with one 
+ *  reciprocal per point; the increments are multiplied by the column, 
+ *  instead of accumulated, so that the rounding errors do not grow
+ *
+ */
+void project_row
+(
+  int   y,   //row of the points
+  int   nx,  //number of points of the row
+  float *m,  //matrix of the transformation
+  float *xp, //x components of the transformed points
+  float *yp  //y components of the transformed points
+)
+{
+  float x0=m[1]*y+m[2];
+  float y0=m[4]*y+m[5];
+
+  if(m[6]==0 && m[7]==0)
+    for(int x=0; x<nx; x++)
+    {
+      xp[x]=x0+m[0]*x;
+      yp[x]=y0+m[3]*x;
+    }
+  else
+  {
+    float d0=m[7]*y+m[8];
+    for(int x=0; x<nx; x++)
+    {
+      float d=1/(d0+m[6]*x);
+      xp[x]=(x0+m[0]*x)*d;
+      yp[x]=(y0+m[3]*x)*d;
+    }
+  }
+}
+
 /**
  *
  *  Function to convert a parametric model to its matrix representation
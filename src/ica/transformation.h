@@ -20,6 +20,9 @@
 #define AFFINITY_TRANSFORM    6
 #define HOMOGRAPHY_TRANSFORM  8
 
+//largest number of parameters
+#define MAX_NPARAMS HOMOGRAPHY_TRANSFORM
+
 
 /**
  *
@@ -66,6 +69,43 @@ void project
 );
 
 
+/**
+ *
+ *  Function to transform a 2D point (x,y) through the matrix of a 
+ *  parametric model (params2matrix), without trigonometry or branches
+ *
+ */
+inline void project_point
+(
+  float x,   //x component of the 2D point
+  float y,   //y component of the 2D point
+  float *m,  //matrix of the transformation
+  float &xp, //x component of the transformed point
+  float &yp  //y component of the transformed point
+)
+{
+  float d=m[6]*x+m[7]*y+m[8];
+  xp=(m[0]*x+m[1]*y+m[2])/d;
+  yp=(m[3]*x+m[4]*y+m[5])/d;
+}
+
+
+/**
+ *
+ *  Function to transform the points (0,y),...,(nx-1,y) of a row through 
+ *  the matrix of a parametric model (params2matrix)
+ *
+ */
+void project_row
+(
+  int   y,   //row of the points
+  int   nx,  //number of points of the row
+  float *m,  //matrix of the transformation
+  float *xp, //x components of the transformed points
+  float *yp  //y components of the transformed points
+);
+
+
 /**
  *
  *  Function to convert a parametric model to its matrix representation
@@ -16,6 +16,10 @@
 #include "transformation.h"
 
 #define ZOOM_SIGMA_ZERO 0.7
+#define ZOOM_PRECISION 4
+
+//room for the kernel of the zoom sigma: ZOOM_PRECISION*1.21+1 values
+#define ZOOM_KERNEL_SIZE 8
 
 
 /**
@@ -39,6 +43,7 @@ void zoom_size
 /**
   *
   * Function to downsample the image
+  * It uses two auxiliary images of the same size as the input image
   *
 **/
 void zoom_out
@@ -46,11 +51,13 @@ void zoom_out
   float *I,    //input image
   float *Iout, //output image
   int   nx,    //image width
-  int   ny     //image height          
+  int   ny,    //image height          
+  float *Is,   //auxiliary image for the smoothed image
+  float *It    //auxiliary image for the convolution
 )
 {
   int nxx, nyy; 
-  float *Is=new float[nx*ny];
+  double B[ZOOM_KERNEL_SIZE];
 
   //calculate the size of the zoomed image
   zoom_size(nx, ny, nxx, nyy);
@@ -60,7 +67,11 @@ void zoom_out
   float sigma=ZOOM_SIGMA_ZERO*sqrt(3); 
 
   //pre-smooth the image
-  gaussian(I, Is, nx, ny, sigma, 4);
+  int size=gaussian_kernel(B, sigma, ZOOM_PRECISION);
+  if(size>nx) 
+    for(int i=0; i<nx*ny; i++) Is[i]=I[i];
+  else
+    gaussian(I, Is, It, B, size, nx, ny);
   
   //re-sample image
   #pragma omp parallel for
@@ -71,7 +82,29 @@ void zoom_out
       int j2=2*j1;
       Iout[i1*nxx+j1]=Is[i2*nx+j2];
     }   
+}
+
+
+/**
+  *
+  * Function to downsample the image
+  *
+**/
+void zoom_out
+(
+  float *I,    //input image
+  float *Iout, //output image
+  int   nx,    //image width
+  int   ny     //image height          
+)
+{
+  float *Is=new float[nx*ny];
+  float *It=new float[nx*ny];
+
+  zoom_out(I, Iout, nx, ny, Is, It);
+
   delete []Is;
+  delete []It;
 }
 
 
@@ -24,6 +24,22 @@ void zoom_size
   int &nyy  //height of the zoomed image
 );
 
+/**
+  *
+  * Function to downsample the image
+  * It uses two auxiliary images of the same size as the input image
+  *
+**/
+void zoom_out
+(
+  float *I,    //input image
+  float *Iout, //output image
+  int   nx,    //image width
+  int   ny,    //image height          
+  float *Is,   //auxiliary image for the smoothed image
+  float *It    //auxiliary image for the convolution
+);
+
 /**
   *
   * Function to downsample the image
@@ -12,15 +12,32 @@
 #include <string.h>
 #include <algorithm> 
 
+#include <thread>
+
 #include "estadeo.h"
+#include "offline.h"
+#include "pipeline.h"
+#include "segments.h"
 #include "utils.h"
 #include "transformation.h"
 
 
+//processing modes
+#define ONLINE_STABILIZATION  0
+#define OFFLINE_STABILIZATION 1
+#define SEGMENT_STABILIZATION 2
+#define ESTIMATE_TRAJECTORY   3
+#define APPLY_TRAJECTORY      4
+
 #define PAR_DEFAULT_OUTVIDEO "output_video.raw"
 #define PAR_DEFAULT_TRANSFORM SIMILARITY_TRANSFORM
 #define PAR_DEFAULT_SIGMA_T 30.0
+#define PAR_DEFAULT_SMOOTHING LOCAL_MATRIX_SMOOTHING
+#define PAR_DEFAULT_MODE ONLINE_STABILIZATION
+#define PAR_DEFAULT_NTHREADS 0
 #define PAR_DEFAULT_OUTTRANSFORM "transform.mat"
+#define PAR_DEFAULT_TRAJECTORY "trajectory.bin"
+#define PAR_DEFAULT_CACHE NULL
 #define PAR_DEFAULT_VERBOSE 0
 
 
@@ -39,6 +56,16 @@ void print_help(char *name)
   printf("  'height' is the height of the images in pixels.\n");
   printf("  'nframes' is the number of frames in the video.\n");
   printf("  -----------------------------------------------\n");
+  printf("  Pipe mode:\n");
+  printf("  Use '-' as 'raw_input_video' to read from the standard input,\n");
+  printf("  '-o -' to write to the standard output and '-' or 0 as\n");
+  printf("  'nframes' to process the frames until the end of the stream:\n");
+  printf("  'ffmpeg -i video.mp4 -f rawvideo -pix_fmt rgb24 - | %s - 640 360"
+         " - -o - |\n", name);
+  printf("  ffmpeg -f rawvideo -pix_fmt rgb24 -video_size 640x360 "
+         "-framerate 30 -i -\n");
+  printf("  -pix_fmt yuv420p output_video.mp4'\n");
+  printf("  -----------------------------------------------\n");
   printf("  Converting to raw data:\n");
   printf("  'avconv -i video.mp4 -f rawvideo -pix_fmt rgb24 -y "
          "raw_video.raw'\n");
@@ -52,6 +79,7 @@ void print_help(char *name)
   printf("  OPTIONS:\n"); 
   printf("  --------\n");
   printf("   -o name  output video name to write the computed raw video\n");
+  printf("              ('-' for the standard output)\n");
   printf("              default value '%s'\n", PAR_DEFAULT_OUTVIDEO);
   printf("   -t N     transformation type to be computed:\n");
   printf("              2.translation; 3.Euclidean transform;\n");
@@ -59,14 +87,40 @@ void print_help(char *name)
   printf("              default value %d\n", PAR_DEFAULT_TRANSFORM);
   printf("   -st N      Gaussian standard deviation for temporal dimension\n");
   printf("              default value %f\n", PAR_DEFAULT_SIGMA_T);
+  printf("              a list 'N1,N2,...' in the modes 1 and 3 estimates\n");
+  printf("              the motion once and writes one video or trajectory\n");
+  printf("              per sigma, adding '_stN' to the file names\n");
+  printf("   -sm N    motion smoothing strategy:\n");
+  printf("              0.local matrix based smoothing (Gaussian window);\n");
+  printf("              1.recursive smoothing (causal, constant cost)\n");
+  printf("              default value %d\n", PAR_DEFAULT_SMOOTHING);
+  printf("   -mode N  processing mode:\n");
+  printf("              0.online, frame by frame;\n");
+  printf("              1.offline, smoothing the whole trajectory (the\n");
+  printf("              local matrix based smoothing with all the frames);\n");
+  printf("              2.online, in parallel segments of a video file;\n");
+  printf("              3.offline estimation only, writing the trajectory\n");
+  printf("              file; 4.offline rendering only, reading it\n");
+  printf("              default value %d\n", PAR_DEFAULT_MODE);
+  printf("   -j N     number of threads of the offline mode and number of\n");
+  printf("              segments of the segments mode\n");
+  printf("              default value %d (number of processors)\n", 
+         PAR_DEFAULT_NTHREADS);
+  printf("   -T name  binary trajectory file of the modes 3 and 4\n");
+  printf("              default value '%s'\n", PAR_DEFAULT_TRAJECTORY);
+  printf("   -c dir   directory of the motion cache of the modes 1 and 3:\n");
+  printf("              the motion of a video is estimated once for each\n");
+  printf("              type of transformation and reused with any sigma\n");
   printf("   -w name  write transformations to file\n");
   printf("   -f name  write stabilizing transformations to file\n");
+  printf("              (names ending in '.bin' for binary files of floats)\n");
   printf("   -v       switch on verbose mode \n\n\n");
 }
 
 /**
  *
  *  Read command line parameters 
+ *  It returns 0 after printing the help and -1 for invalid parameters
  *
  */
 int read_parameters(
@@ -76,11 +130,17 @@ int read_parameters(
   char  *video_out,
   char  **out_transform,
   char  **out_smooth_transform,
+  char  **trajectory,
+  char  **cache,
   int   &width,
   int   &height,
   int   &nframes,
   int   &nparams,
-  float &sigma,
+  float *sigma,
+  int   &nsigmas,
+  int   &smoothing,
+  int   &mode,
+  int   &nthreads,
   int   &verbose
 )
 {
@@ -97,11 +157,17 @@ int read_parameters(
 
     *out_transform=NULL;
     *out_smooth_transform=NULL;
+    *trajectory=(char *) PAR_DEFAULT_TRAJECTORY;
+    *cache=PAR_DEFAULT_CACHE;
     
     //assign default values to the parameters
     strcpy(video_out,PAR_DEFAULT_OUTVIDEO);
     nparams=PAR_DEFAULT_TRANSFORM;
-    sigma=PAR_DEFAULT_SIGMA_T;
+    sigma[0]=PAR_DEFAULT_SIGMA_T;
+    nsigmas=1;
+    smoothing=PAR_DEFAULT_SMOOTHING;
+    mode=PAR_DEFAULT_MODE;
+    nthreads=PAR_DEFAULT_NTHREADS;
     verbose=PAR_DEFAULT_VERBOSE;
     
     //read each parameter from the command line
@@ -117,8 +183,49 @@ int read_parameters(
 
       if(strcmp(argv[i],"-st")==0)
         if(i<argc-1)
-          sigma=atof(argv[++i]);
+        {
+          //read a list of sigmas separated by commas
+          char *s=argv[++i], *end;
+          nsigmas=0;
+          do {
+            if(nsigmas==MAX_SIGMAS)
+            {
+              fprintf(stderr, "Error: At most %d sigmas can be given.\n",
+                      MAX_SIGMAS);
+              return -1;
+            }
+
+            sigma[nsigmas++]=strtod(s, &end);
+            if(end==s || (*end!=',' && *end!='\0'))
+            {
+              fprintf(stderr, "Error: Invalid list of sigmas '%s'.\n",
+                      argv[i]);
+              return -1;
+            }
+            s=end;
+          } while(*s++==',');
+        }
+        
+      if(strcmp(argv[i],"-sm")==0)
+        if(i<argc-1)
+          smoothing=atoi(argv[++i]);
+        
+      if(strcmp(argv[i],"-mode")==0)
+        if(i<argc-1)
+          mode=atoi(argv[++i]);
+        
+      if(strcmp(argv[i],"-j")==0)
+        if(i<argc-1)
+          nthreads=atoi(argv[++i]);
         
+      if(strcmp(argv[i],"-T")==0)
+        if(i<argc-1)
+          *trajectory=argv[++i];
+
+      if(strcmp(argv[i],"-c")==0)
+        if(i<argc-1)
+          *cache=argv[++i];
+
       if(strcmp(argv[i],"-w")==0)
         if(i<argc-1)
           *out_transform=argv[++i];
@@ -136,39 +243,25 @@ int read_parameters(
     //check parameter values
     if(nparams!=2 && nparams!=3 && nparams!=4 && 
        nparams!=6 && nparams!=8) nparams=PAR_DEFAULT_TRANSFORM;
-    if(sigma<0.01)
-       sigma=0.01;
+    for(int k=0; k<nsigmas; k++)
+      if(sigma[k]<0.01)
+         sigma[k]=0.01;
+    if(mode!=OFFLINE_STABILIZATION && mode!=ESTIMATE_TRAJECTORY)
+       nsigmas=1;
+    if(smoothing!=LOCAL_MATRIX_SMOOTHING && smoothing!=RECURSIVE_SMOOTHING)
+       smoothing=PAR_DEFAULT_SMOOTHING;
+    if(mode!=ONLINE_STABILIZATION && mode!=OFFLINE_STABILIZATION &&
+       mode!=SEGMENT_STABILIZATION && mode!=ESTIMATE_TRAJECTORY &&
+       mode!=APPLY_TRAJECTORY)
+       mode=PAR_DEFAULT_MODE;
+    if(nthreads<=0)
+       nthreads=std::max((int)std::thread::hardware_concurrency(), 1);
   }
 
   return 1;
 }
 
 
-/**
-  *
-  *  Function for converting an rgb image to grayscale levels
-  * 
-**/
-void rgb2gray(
-  float *rgb,  //input color image
-  float *gray, //output grayscale image
-  int nx,      //number of pixels
-  int ny, 
-  int nz
-)
-{
-  int size=nx*ny;
-  if(nz>=3)
-    #pragma omp parallel for
-    for(int i=0;i<size;i++)
-      gray[i]=(0.2989*rgb[i*nz]+0.5870*rgb[i*nz+1]+0.1140*rgb[i*nz+2]);
-  else
-    #pragma omp parallel for
-    for(int i=0;i<size;i++)
-      gray[i]=rgb[i];
-}
-
-
 /**
  *
  *  Main program:
@@ -180,100 +273,155 @@ int main (int argc, char *argv[])
 {
   //parameters of the method
   char  *video_in, video_out[300];
-  char  *out_transform, *out_stransform;
+  char  *out_transform, *out_stransform, *trajectory, *cache;
   int   width, height, nchannels=3, nframes;
-  int   nparams, verbose;
-  float sigma;
+  int   nparams, smoothing, mode, nthreads, verbose, nsigmas;
+  float sigma[MAX_SIGMAS];
   
   //read the parameters from the console
   int result=read_parameters(
     argc, argv, &video_in, video_out, &out_transform, &out_stransform,
-    width, height, nframes, nparams, sigma, verbose
+    &trajectory, &cache, width, height, nframes, nparams, sigma, nsigmas,
+    smoothing, mode, nthreads, verbose
   );
   
+  if(result<0) return EXIT_FAILURE;
+  
   if(result)
   {
+    //verbose messages cannot be mixed with the output video stream
+    FILE *log=(strcmp(video_out, "-")==0)? stderr: stdout;
+    
     if(verbose)
-      printf(
+    {
+      fprintf(log,
         " Input video: '%s'\n Output video: '%s'\n Width: %d, Height: %d,"
-        " Number of frames: %d\n Transformation: %d\n sigma: %f\n",
-        video_in, video_out, width, height, nframes, nparams, sigma
+        " Number of frames: %d\n Transformation: %d\n sigma:",
+        video_in, video_out, width, height, nframes, nparams
       );
+      for(int k=0; k<nsigmas; k++) fprintf(log, " %f", sigma[k]);
+      fprintf(log, "\n Smoothing: %d\n Mode: %d\n", smoothing, mode);
+    }
     
     int fsize=width*height;
     int csize=fsize*nchannels;
-    int vsize=csize*nframes;
     
-    unsigned char *I=new unsigned char[vsize];
-   
-    size_t r=read_video(video_in, I, vsize);
+    //open the input and output streams; the estimation mode does not
+    //write any video and the offline mode writes one video per sigma
+    video_reader input(video_in, csize);
     
-    if(r<=0)
+    if(!input.is_open())
     {
       fprintf(stderr, "Error: Cannot read the input video '%s'.\n", video_in);
       return EXIT_FAILURE;
     }
 
-    if(verbose) printf(" Size of video in bytes %d\n", (int) r);
-
-    //convert the input video to float and gray levels
-    float *Ic=new float[csize];
-    float *I1=new float[fsize];
-    float *I2=new float[fsize];
-    
-    if(verbose) printf("\n Starting the stabilization\n");
-
-    //read the first frame from input stream
-    for(int i=0; i<csize; i++)
-      Ic[i]=(float)I[i];
-  
-    //convert it to grayscale
-    rgb2gray(Ic, I1, width, height, nchannels);
+    int noutputs=(mode==ESTIMATE_TRAJECTORY)? 1: nsigmas;
+    if(noutputs>1 && strcmp(video_out, "-")==0)
+    {
+      fprintf(stderr, "Error: Cannot write several videos to the standard "
+              "output.\n");
+      return EXIT_FAILURE;
+    }
 
-    Timer timer;
-    estadeo stabilize(nparams, sigma, verbose);
-    
-    for(int f=1; f<nframes; f++)
+    video_writer *outputs[MAX_SIGMAS];
+    for(int k=0; k<noutputs; k++)
     {
-      //read the next frame from input stream
-      for(int i=0; i<csize; i++)
-        Ic[i]=(float)I[f*csize+i];
-      
-      //convert it to grayscale
-      rgb2gray(Ic, I2, width, height, nchannels);
-      
-      //call the method for stabilizing the current frame
-      stabilize.process_frame(I1, I2, Ic, timer, width, height, nchannels);
+      char name[300];
+      char *file=video_out;
+      if(mode==ESTIMATE_TRAJECTORY) file=NULL;
+      else if(nsigmas>1)
+        file=sigma_file_name(video_out, sigma[k], name, sizeof(name));
 
-      if(verbose) timer.print_time(f);
-      
-      //save the stabilized video to the output stream
-      for(int i=0; i<csize; i++)
+      outputs[k]=new video_writer(file, csize);
+      if(file!=NULL && !outputs[k]->is_open())
       {
-        if(Ic[i]<0) I[f*csize+i]=0;
-        else if(Ic[i]>255) I[f*csize+i]=255;
-        else I[f*csize+i]=(unsigned char)Ic[i];
+        fprintf(stderr, "Error: Cannot write the output video '%s'.\n", 
+                file);
+        return EXIT_FAILURE;
       }
-      
-      std::swap(I1, I2);
-      
-      //save the motion transformations 
-      if(out_transform!=NULL)
-        save_transform(out_transform, stabilize.get_H(), nparams);
+    }
+    video_writer &output=*outputs[0];
+
+    if(verbose) fprintf(log, " Size of frames in bytes %d\n", csize);
+
+    if(verbose) fprintf(log, "\n Starting the stabilization\n");
 
-      //save the stabilizing transformation
-      if(out_stransform!=NULL)
-        save_transform(out_stransform, stabilize.get_smooth_H(), nparams);
+    Timer timer;
+    int f;
+    
+    if(mode==OFFLINE_STABILIZATION)
+    {
+      //estimate the motion of the whole video, smooth it and warp the
+      //frames in parallel
+      f=offline_stabilization(
+        input, outputs, nparams, sigma, nsigmas, nthreads, cache, timer, 
+        nframes, width, height, nchannels, out_transform, out_stransform, 
+        verbose, log
+      );
+    }
+    else if(mode==ESTIMATE_TRAJECTORY)
+    {
+      //estimate and smooth the motion, and write the trajectory file
+      f=estimate_stabilization(
+        input, trajectory, nparams, sigma, nsigmas, nthreads, cache, timer,
+        nframes, width, height, nchannels, out_transform, out_stransform, 
+        verbose, log
+      );
+    }
+    else if(mode==APPLY_TRAJECTORY)
+    {
+      //warp the frames in parallel with the transformations of the file
+      f=apply_stabilization(
+        input, output, trajectory, nthreads, timer, nframes,
+        width, height, nchannels, verbose, log
+      );
+    }
+    else if(mode==SEGMENT_STABILIZATION)
+    {
+      //stabilize segments of the video in parallel, each one starting
+      //with the frames needed by the smoothing
+      f=segment_stabilization(
+        input, output, nparams, sigma[0], smoothing, nthreads, timer, nframes,
+        width, height, nchannels, out_transform, out_stransform, verbose, log
+      );
+    }
+    else
+    {
+      estadeo stabilize(nparams, sigma[0], smoothing, verbose);
+    
+      //read, stabilize and write the frames concurrently
+      f=online_stabilization(
+        input, output, stabilize, timer, nframes, width, height, nchannels,
+        out_transform, out_stransform, verbose, log
+      );
     }
-        
-    if(verbose) timer.print_avg_time(nframes);
     
-    write_video(video_out, I, vsize);
+    //the errors of the output files are already reported
+    if(f<0) return EXIT_FAILURE;
     
-    delete []I;
-    delete []Ic;
-    delete []I1;
-    delete []I2;
+    if(f==0)
+    {
+      fprintf(stderr, "Error: Cannot read the input video '%s'.\n", video_in);
+      return EXIT_FAILURE;
+    }
+        
+    //the buffered frames are written when the videos are closed
+    bool written=true;
+    for(int k=0; k<noutputs; k++)
+    {
+      written=outputs[k]->close() && written;
+      delete outputs[k];
+    }
+
+    if(!written)
+    {
+      fprintf(stderr, "Error: Cannot write the output video '%s'.\n", 
+              video_out);
+      return EXIT_FAILURE;
+    }
+        
+    if(verbose) timer.print_avg_time(f, log);
   }
 
   return EXIT_SUCCESS;
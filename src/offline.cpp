@@ -0,0 +1,704 @@
+// This program is free software: you can use, modify and/or redistribute it
+// under the terms of the simplified BSD License. You should have received a
+// copy of this license along this program. If not, see
+// <http://www.opensource.org/licenses/bsd-license.html>.
+//
+// Copyright (C) 2019, Javier Sánchez Pérez <jsanchez@ulpgc.es>
+// All rights reserved.
+
+
+#include "offline.h"
+#include "estadeo.h"
+#include "trajectory.h"
+#include "color_bicubic_interpolation.h"
+#include "inverse_compositional_algorithm.h"
+#include "transformation.h"
+
+#include <math.h>
+#include <fftw3.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+
+/**
+  *
+  * Function to smooth a whole trajectory with a Gaussian convolution
+  * computed through the FFT, with symmetric boundary conditions
+  * The trajectory of each frame is the composition of all the previous
+  * motions, T_i=H_i o T_{i-1}; it is convolved in each parameter and
+  * the smoothing transform of a frame is T~_i o T_i^{-1}, which is the
+  * Gaussian average of the transformations of the other frames with
+  * respect to it, as in the local matrix based smoothing
+  *
+**/
+void trajectory_smoothing(
+  float *H,     //motion between each frame and the previous one
+  float *Hp,    //output stabilizing transformations
+  int   n,      //number of frames
+  int   nparams,//number of parameters of the transformations
+  float sigma   //Gaussian standard deviation
+)
+{
+  int radius=(int)(3*sigma);
+
+  //size of the signal extended with radius frames on each side
+  int M=n+2*radius;
+  int Mc=M/2+1;
+
+  std::vector<float> T(n*nparams), Ts(n*nparams), T_1(nparams);
+
+  //compute the trajectory, starting with the identity
+  for(int p=0; p<nparams; p++) T[p]=0;
+  for(int i=1; i<n; i++)
+    compose_transform(
+      &H[i*nparams], &T[(i-1)*nparams], &T[i*nparams], nparams
+    );
+
+  double *x=(double *) fftw_malloc(sizeof(double)*M);
+  fftw_complex *X=(fftw_complex *) fftw_malloc(sizeof(fftw_complex)*Mc);
+  fftw_complex *G=(fftw_complex *) fftw_malloc(sizeof(fftw_complex)*Mc);
+
+  fftw_plan forward =fftw_plan_dft_r2c_1d(M, x, X, FFTW_ESTIMATE);
+  fftw_plan backward=fftw_plan_dft_c2r_1d(M, X, x, FFTW_ESTIMATE);
+
+  //Gaussian kernel centered at the origin of the periodic signal,
+  //normalized with the size of the inverse transform
+  double sum=0.0;
+  for(int m=0; m<M; m++) x[m]=0.0;
+  for(int d=-radius; d<=radius; d++)
+  {
+    double g=exp(-0.5*d*d/(sigma*sigma));
+    x[(d+M)%M]+=g;
+    sum+=g;
+  }
+  for(int m=0; m<M; m++) x[m]/=sum*M;
+
+  fftw_execute(forward);
+  for(int k=0; k<Mc; k++)
+  {
+    G[k][0]=X[k][0];
+    G[k][1]=X[k][1];
+  }
+
+  //convolve each parameter separately
+  for(int p=0; p<nparams; p++)
+  {
+    //extend the trajectory mirroring the frames outside the video
+    for(int m=0; m<M; m++)
+    {
+      int j=m-radius;
+      while(j<0 || j>n-1)
+        j=(j>n-1)? 2*n-1-j: -j;
+      x[m]=T[j*nparams+p];
+    }
+
+    fftw_execute(forward);
+    for(int k=0; k<Mc; k++)
+    {
+      double re=X[k][0]*G[k][0]-X[k][1]*G[k][1];
+      double im=X[k][0]*G[k][1]+X[k][1]*G[k][0];
+      X[k][0]=re;
+      X[k][1]=im;
+    }
+    fftw_execute(backward);
+
+    //the extended signal does not wrap around in the valid frames
+    for(int i=0; i<n; i++)
+      Ts[i*nparams+p]=(float) x[i+radius];
+  }
+
+  fftw_destroy_plan(forward);
+  fftw_destroy_plan(backward);
+  fftw_free(x);
+  fftw_free(X);
+  fftw_free(G);
+
+  //compute the stabilizing transformations
+  for(int i=0; i<n; i++)
+  {
+    float Hs[MAX_NPARAMS];
+
+    inverse_transform(&T[i*nparams], &T_1[0], nparams);
+    compose_transform(&Ts[i*nparams], &T_1[0], Hs, nparams);
+    inverse_transform(Hs, &Hp[i*nparams], nparams);
+  }
+}
+
+
+/**
+  *
+  * Function to warp a frame with one or several stabilizing
+  * transformations, one for each sigma of a sweep
+  *
+**/
+void warp_frame(
+  unsigned char *I,   //frame to be warped
+  unsigned char **Io, //output warped frames, one per transformation
+  float **H,          //stabilizing transformations
+  int   nH,           //number of transformations
+  int   nparams,      //number of parameters
+  int   nx,           //number of columns
+  int   ny,           //number of rows
+  int   nz            //number of channels
+)
+{
+  for(int k=0; k<nH; k++)
+    bicubic_interpolation(I, Io[k], H[k], nparams, nx, ny, nz);
+}
+
+
+/**
+  *
+  * Function to estimate the motion of a chunk of consecutive frames
+  * It uses its own workspace, so several chunks can run in parallel
+  *
+**/
+void estimate_chunk(
+  unsigned char **I, //frames of the chunk
+  int   m,           //number of frames
+  float *H,          //output motion of the frames after the first one
+  float *I1,         //auxiliary grayscale frames
+  float *I2,
+  int   nparams,     //number of parameters
+  int   nx,          //number of columns
+  int   ny,          //number of rows
+  int   nz           //number of channels
+)
+{
+  ica_workspace *ica=NULL;
+  
+  rgb2gray(I[0], I1, nx, ny, nz);
+  for(int j=1; j<m; j++)
+  {
+    rgb2gray(I[j], I2, nx, ny, nz);
+    estimate_motion(ica, I1, I2, &H[(j-1)*nparams], nparams, nx, ny);
+    std::swap(I1, I2);
+  }
+  
+  delete ica;
+}
+
+
+/**
+  *
+  * Function to compute the motion between consecutive frames of a video,
+  * in batches of MOTION_CHUNK frames per thread, each chunk with its own
+  * workspace
+  * It returns the number of frames read
+  *
+**/
+int estimate_video_motion(
+  video_reader &input,    //input video stream
+  std::vector<float> &H,  //output motion of every frame
+  int   nparams,          //number of parameters of the transformations
+  int   nthreads,         //number of threads
+  int   nframes,          //number of frames (non-positive for all)
+  int   nx,               //number of columns
+  int   ny,               //number of rows
+  int   nz                //number of channels
+)
+{
+  int fsize=nx*ny;
+  int csize=fsize*nz;
+
+  int B=MOTION_CHUNK*nthreads;
+  unsigned char **F=new unsigned char*[B+1];
+  float **I1=new float*[nthreads];
+  float **I2=new float*[nthreads];
+  for(int i=0; i<=B; i++) F[i]=new unsigned char[csize];
+  for(int t=0; t<nthreads; t++)
+  {
+    I1[t]=new float[fsize];
+    I2[t]=new float[fsize];
+  }
+
+  //the first frame does not move
+  H.assign(nparams, 0.0f);
+  std::vector<std::thread> workers;
+
+  int n=input.read_frame(F[0])? 1: 0;
+  while(n>0)
+  {
+    //read the next batch after the last frame of the previous one
+    int m=0;
+    while(m<B && (nframes<=0 || n+m<nframes) && input.read_frame(F[m+1]))
+      m++;
+    if(m==0) break;
+
+    H.resize((n+m)*nparams);
+
+    for(int t=0, s=0; t<nthreads && s<m; t++, s+=MOTION_CHUNK)
+      workers.push_back(std::thread(
+        estimate_chunk, &F[s], std::min(MOTION_CHUNK, m-s)+1, 
+        &H[(n+s)*nparams], I1[t], I2[t], nparams, nx, ny, nz
+      ));
+
+    for(unsigned int t=0; t<workers.size(); t++)
+      workers[t].join();
+    workers.clear();
+
+    n+=m;
+    std::swap(F[0], F[m]);
+  }
+
+  for(int i=0; i<=B; i++) delete []F[i];
+  for(int t=0; t<nthreads; t++)
+  {
+    delete []I1[t];
+    delete []I2[t];
+  }
+  delete []F;
+  delete []I1;
+  delete []I2;
+
+  return n;
+}
+
+
+/**
+  *
+  * Function to compute a 64 bits hash (FNV-1a) of the frames of a video
+  * It returns the number of frames read
+  *
+**/
+int hash_video(
+  video_reader &input,       //input video stream
+  unsigned long long &hash,  //output hash of the frames
+  int   nframes,             //number of frames (non-positive for all)
+  int   csize                //number of bytes of a frame
+)
+{
+  unsigned char *I=new unsigned char[csize];
+
+  hash=14695981039346656037ull;
+  int n=0;
+  while((nframes<=0 || n<nframes) && input.read_frame(I))
+  {
+    for(int i=0; i<csize; i++)
+    {
+      hash^=I[i];
+      hash*=1099511628211ull;
+    }
+    n++;
+  }
+
+  delete []I;
+  return n;
+}
+
+
+/**
+  *
+  * Function to compute the motion between consecutive frames of a video
+  * through a persistent cache: the motion is read from the cache if the
+  * same frames were processed with the same type of transformation, so
+  * runs with another sigma do not repeat the estimation
+  * The frames are hashed in a first reading of the video
+  * It returns the number of frames
+  *
+**/
+int cached_video_motion(
+  video_reader &input,    //input video stream
+  std::vector<float> &H,  //output motion of every frame
+  char  *cache,           //directory of the motion cache (or NULL)
+  int   nparams,          //number of parameters of the transformations
+  int   nthreads,         //number of threads
+  int   nframes,          //number of frames (non-positive for all)
+  int   nx,               //number of columns
+  int   ny,               //number of rows
+  int   nz,               //number of channels
+  int   verbose,          //switch on verbose mode
+  FILE  *log              //stream for verbose messages
+)
+{
+  if(cache==NULL)
+    return estimate_video_motion(
+      input, H, nparams, nthreads, nframes, nx, ny, nz
+    );
+
+  input.keep_frames();
+
+  unsigned long long hash;
+  int n=hash_video(input, hash, nframes, nx*ny*nz);
+  if(n==0 || !input.rewind()) return 0;
+
+  char name[1024];
+  snprintf(
+    name, sizeof(name), "%s/%016llx_%dx%d_%d.mot", 
+    cache, hash, nx, ny, nparams
+  );
+
+  if(load_motion(name, H, n, nparams, nx, ny))
+  {
+    if(verbose) fprintf(log, " Motion read from the cache '%s'\n", name);
+    return n;
+  }
+
+  n=estimate_video_motion(input, H, nparams, nthreads, n, nx, ny, nz);
+
+  if(n>0 && !save_motion(name, &H[0], n, nparams, nx, ny))
+    fprintf(stderr, "Warning: Cannot write the motion cache '%s'.\n", name);
+
+  return n;
+}
+
+
+/**
+  *
+  * Function to save the transformations of every frame but the first one
+  * It returns false if the files cannot be written
+  *
+**/
+bool save_transforms(
+  float *H,              //motion of every frame
+  float *Hp,             //stabilizing transformation of every frame
+  int   n,               //number of frames
+  int   nparams,         //number of parameters of the transformations
+  char  *out_transform,  //file for the transformations
+  char  *out_stransform  //file for the stabilizing transformations
+)
+{
+  transform_writer wt(out_transform, nparams);
+  transform_writer ws(out_stransform, nparams);
+
+  for(int i=1; i<n; i++)
+  {
+    if(wt.is_open())
+      wt.write(&H[i*nparams]);
+
+    if(ws.is_open())
+    {
+      float Hp_1[MAX_NPARAMS], Htmp[MAX_NPARAMS], Hs[MAX_NPARAMS];
+
+      inverse_transform(&Hp[i*nparams], Hp_1, nparams);
+      compose_transform(&H[i*nparams], &Hp[i*nparams], Htmp, nparams);
+      compose_transform(Hp_1, Htmp, Hs, nparams);
+      ws.write(Hs);
+    }
+  }
+
+  bool saved=wt.close();
+  saved=ws.close() && saved;
+  if(!saved)
+    fprintf(stderr, "Error: Cannot write the transformations.\n");
+
+  return saved;
+}
+
+
+/**
+  *
+  * Function to warp the frames of a video in parallel, in batches of one
+  * frame per thread
+  * Each frame is read once and warped with the trajectory of every output,
+  * one for each sigma of a sweep
+  * It returns the number of frames processed; the warping stops when a 
+  * frame cannot be written
+  *
+**/
+int render_frames(
+  video_reader &input,   //input video stream
+  video_writer **output, //output video streams
+  float **Hp,            //stabilizing transformations of every output
+  int   nout,            //number of outputs
+  int   n,               //number of frames
+  int   nparams,         //number of parameters of the transformations
+  int   nthreads,        //number of threads
+  int   nx,              //number of columns
+  int   ny,              //number of rows
+  int   nz               //number of channels
+)
+{
+  int csize=nx*ny*nz;
+
+  unsigned char **Ib=new unsigned char*[nthreads];
+  unsigned char **Io=new unsigned char*[nthreads*nout];
+  float **Ht=new float*[nthreads*nout];
+  for(int t=0; t<nthreads; t++)
+    Ib[t]=new unsigned char[csize];
+  for(int t=0; t<nthreads*nout; t++)
+    Io[t]=new unsigned char[csize];
+
+  std::vector<std::thread> workers;
+
+  int f=0;
+  while(f<n)
+  {
+    int m=std::min(nthreads, n-f);
+
+    for(int t=0; t<m; t++)
+      if(!input.read_frame(Ib[t])) m=t;
+    if(m==0) break;
+
+    for(int t=0; t<m; t++)
+    {
+      for(int k=0; k<nout; k++)
+        Ht[t*nout+k]=&Hp[k][(f+t)*nparams];
+
+      workers.push_back(std::thread(
+        warp_frame, Ib[t], &Io[t*nout], &Ht[t*nout], nout,
+        nparams, nx, ny, nz
+      ));
+    }
+
+    for(int t=0; t<m; t++)
+      workers[t].join();
+    workers.clear();
+
+    bool written=true;
+    for(int t=0; t<m; t++)
+      for(int k=0; k<nout; k++)
+        written=output[k]->write_frame(Io[t*nout+k]) && written;
+
+    f+=m;
+
+    //stop at the first failed write
+    if(!written) break;
+  }
+
+  for(int t=0; t<nthreads; t++)
+    delete []Ib[t];
+  for(int t=0; t<nthreads*nout; t++)
+    delete []Io[t];
+  delete []Ib;
+  delete []Io;
+  delete []Ht;
+
+  return f;
+}
+
+
+/**
+  *
+  * Offline video stabilization in three passes: motion estimation of the
+  * whole video, smoothing of the whole trajectory and parallel warping
+  * The input video is read twice; the frames of a stream are kept in a
+  * temporary file
+  * With several sigmas, the motion is estimated once and the trajectory
+  * of each sigma is rendered to its own output in the same warping pass
+  * It returns the number of frames processed, or -1 if the transformations
+  * cannot be written
+  *
+**/
+int offline_stabilization(
+  video_reader &input,   //input video stream
+  video_writer **output, //output video streams, one per sigma
+  int   nparams,         //number of parameters of the transformations
+  float *sigma,          //Gaussian standard deviations
+  int   nsigmas,         //number of standard deviations
+  int   nthreads,        //number of threads
+  char  *cache,          //directory of the motion cache (or NULL)
+  Timer &timer,          //manage runtimes
+  int   nframes,         //number of frames (non-positive for all)
+  int   nx,              //number of columns
+  int   ny,              //number of rows
+  int   nz,              //number of channels
+  char  *out_transform,  //file for the transformations
+  char  *out_stransform, //file for the stabilizing transformations
+  int   verbose,         //switch on verbose mode
+  FILE  *log             //stream for verbose messages
+)
+{
+  if(nthreads<1) nthreads=1;
+
+  //pass 1. Compute the motion between consecutive frames
+  if(verbose) timer.set_t1();
+
+  input.keep_frames();
+
+  std::vector<float> H;
+  int n=cached_video_motion(
+    input, H, cache, nparams, nthreads, nframes, nx, ny, nz, verbose, log
+  );
+
+  if(n==0) return 0;
+
+  if(verbose) fprintf(log, " Motion estimated in %d frames\n", n);
+
+  //pass 2. Smooth the whole trajectory with each sigma
+  if(verbose) timer.set_t2();
+
+  std::vector<float> Hp(nsigmas*n*nparams);
+  std::vector<float *> Hk(nsigmas);
+  for(int k=0; k<nsigmas; k++)
+  {
+    char name[1024];
+
+    Hk[k]=&Hp[k*n*nparams];
+    trajectory_smoothing(&H[0], Hk[k], n, nparams, sigma[k]);
+
+    if(!save_transforms(
+      &H[0], Hk[k], n, nparams, (k==0)? out_transform: NULL,
+      (nsigmas>1)? 
+        sigma_file_name(out_stransform, sigma[k], name, sizeof(name)):
+        out_stransform
+    )) return -1;
+  }
+
+  //pass 3. Warp the frames in parallel
+  if(verbose) timer.set_t3();
+
+  if(!input.rewind())
+  {
+    fprintf(stderr, "Error: Cannot read the input video again.\n");
+    return 0;
+  }
+
+  render_frames(
+    input, output, &Hk[0], nsigmas, n, nparams, nthreads, nx, ny, nz
+  );
+
+  if(verbose) timer.set_t4();
+
+  return n;
+}
+
+
+/**
+  *
+  * First half of the offline stabilization: it estimates the motion of the
+  * whole video and smooths its trajectory, and writes both to a binary
+  * trajectory file that is rendered later by apply_stabilization
+  * With several sigmas, it writes one trajectory file per sigma
+  * It returns the number of frames processed, or -1 if a trajectory file
+  * or the transformations cannot be written
+  *
+**/
+int estimate_stabilization(
+  video_reader &input,   //input video stream
+  char  *trajectory,     //output binary trajectory file
+  int   nparams,         //number of parameters of the transformations
+  float *sigma,          //Gaussian standard deviations
+  int   nsigmas,         //number of standard deviations
+  int   nthreads,        //number of threads
+  char  *cache,          //directory of the motion cache (or NULL)
+  Timer &timer,          //manage runtimes
+  int   nframes,         //number of frames (non-positive for all)
+  int   nx,              //number of columns
+  int   ny,              //number of rows
+  int   nz,              //number of channels
+  char  *out_transform,  //file for the transformations
+  char  *out_stransform, //file for the stabilizing transformations
+  int   verbose,         //switch on verbose mode
+  FILE  *log             //stream for verbose messages
+)
+{
+  if(nthreads<1) nthreads=1;
+
+  if(verbose) timer.set_t1();
+
+  std::vector<float> H;
+  int n=cached_video_motion(
+    input, H, cache, nparams, nthreads, nframes, nx, ny, nz, verbose, log
+  );
+
+  if(n==0) return 0;
+
+  if(verbose) fprintf(log, " Motion estimated in %d frames\n", n);
+
+  if(verbose) timer.set_t2();
+
+  std::vector<float> Hp(n*nparams);
+  for(int k=0; k<nsigmas; k++)
+  {
+    char name[1024], tname[1024];
+    char *tfile=trajectory;
+    char *sfile=out_stransform;
+    if(nsigmas>1)
+    {
+      tfile=sigma_file_name(trajectory, sigma[k], tname, sizeof(tname));
+      sfile=sigma_file_name(out_stransform, sigma[k], name, sizeof(name));
+    }
+
+    trajectory_smoothing(&H[0], &Hp[0], n, nparams, sigma[k]);
+
+    if(!save_transforms(
+      &H[0], &Hp[0], n, nparams, (k==0)? out_transform: NULL, sfile
+    )) return -1;
+
+    if(!save_trajectory(tfile, &H[0], &Hp[0], n, nparams, nx, ny))
+    {
+      fprintf(stderr, "Error: Cannot write the trajectory '%s'.\n", tfile);
+      return -1;
+    }
+  }
+
+  if(verbose) timer.set_t3();
+
+  if(verbose) timer.set_t4();
+
+  return n;
+}
+
+
+/**
+  *
+  * Second half of the offline stabilization: it warps the frames of the
+  * video in parallel with the stabilizing transformations of a binary
+  * trajectory file, which is mapped in memory
+  * It returns the number of frames processed, or -1 if the trajectory is
+  * not valid for the video
+  *
+**/
+int apply_stabilization(
+  video_reader &input,   //input video stream
+  video_writer &output,  //output video stream
+  char  *trajectory,     //input binary trajectory file
+  int   nthreads,        //number of threads
+  Timer &timer,          //manage runtimes
+  int   nframes,         //number of frames (non-positive for all)
+  int   nx,              //number of columns
+  int   ny,              //number of rows
+  int   nz,              //number of channels
+  int   verbose,         //switch on verbose mode
+  FILE  *log             //stream for verbose messages
+)
+{
+  if(nthreads<1) nthreads=1;
+
+  if(verbose)
+  {
+    timer.set_t1();
+    timer.set_t2();
+  }
+
+  trajectory_file T(trajectory);
+
+  if(!T.is_open())
+  {
+    fprintf(stderr, "Error: Cannot read the trajectory '%s'.\n", trajectory);
+    return -1;
+  }
+
+  if(T.width()!=nx || T.height()!=ny)
+  {
+    fprintf(
+      stderr, "Error: The trajectory '%s' is for frames of %dx%d pixels.\n",
+      trajectory, T.width(), T.height()
+    );
+    return -1;
+  }
+
+  int n=T.number_of_frames();
+  if(nframes>0 && nframes<n) n=nframes;
+
+  if(verbose)
+    fprintf(
+      log, " Trajectory of %d frames, transformation %d\n", 
+      T.number_of_frames(), T.number_of_parameters()
+    );
+
+  if(verbose) timer.set_t3();
+
+  video_writer *out=&output;
+  float *Hp=T.get_Hp();
+  n=render_frames(
+    input, &out, &Hp, 1, n, T.number_of_parameters(), nthreads, nx, ny, nz
+  );
+
+  if(verbose) timer.set_t4();
+
+  return n;
+}
@@ -0,0 +1,121 @@
+// This program is free software: you can use, modify and/or redistribute it
+// under the terms of the simplified BSD License. You should have received a
+// copy of this license along this program. If not, see
+// <http://www.opensource.org/licenses/bsd-license.html>.
+//
+// Copyright (C) 2019, Javier Sánchez Pérez <jsanchez@ulpgc.es>
+// All rights reserved.
+
+
+#ifndef OFFLINE_H
+#define OFFLINE_H
+
+#include <stdio.h>
+
+#include "utils.h"
+
+//number of consecutive frames whose motion is estimated by each thread
+#define MOTION_CHUNK 4
+
+//maximum number of sigmas of a sweep
+#define MAX_SIGMAS 16
+
+
+/**
+ *
+ * Function to smooth a whole trajectory with a Gaussian convolution
+ * computed through the FFT, with symmetric boundary conditions
+ * It computes the stabilizing transformation of every frame from the
+ * motion between consecutive frames
+ *
+**/
+void trajectory_smoothing(
+  float *H,     //motion between each frame and the previous one
+  float *Hp,    //output stabilizing transformations
+  int   n,      //number of frames
+  int   nparams,//number of parameters of the transformations
+  float sigma   //Gaussian standard deviation
+);
+
+
+/**
+ *
+ * Offline video stabilization in three passes: motion estimation of the
+ * whole video, smoothing of the whole trajectory and parallel warping
+ * A sweep of several sigmas writes one output per sigma
+ * It returns the number of frames processed, or -1 if the transformations
+ * cannot be written
+ *
+**/
+int offline_stabilization(
+  video_reader &input,   //input video stream
+  video_writer **output, //output video streams, one per sigma
+  int   nparams,         //number of parameters of the transformations
+  float *sigma,          //Gaussian standard deviations
+  int   nsigmas,         //number of standard deviations
+  int   nthreads,        //number of threads
+  char  *cache,          //directory of the motion cache (or NULL)
+  Timer &timer,          //manage runtimes
+  int   nframes,         //number of frames (non-positive for all)
+  int   nx,              //number of columns
+  int   ny,              //number of rows
+  int   nz,              //number of channels
+  char  *out_transform,  //file for the transformations
+  char  *out_stransform, //file for the stabilizing transformations
+  int   verbose,         //switch on verbose mode
+  FILE  *log             //stream for verbose messages
+);
+
+
+/**
+ *
+ * Estimation half of the offline stabilization: it writes the motion and
+ * the stabilizing transformation of every frame to a binary trajectory file,
+ * one per sigma of a sweep
+ * It returns the number of frames processed, or -1 if a trajectory file
+ * or the transformations cannot be written
+ *
+**/
+int estimate_stabilization(
+  video_reader &input,   //input video stream
+  char  *trajectory,     //output binary trajectory file
+  int   nparams,         //number of parameters of the transformations
+  float *sigma,          //Gaussian standard deviations
+  int   nsigmas,         //number of standard deviations
+  int   nthreads,        //number of threads
+  char  *cache,          //directory of the motion cache (or NULL)
+  Timer &timer,          //manage runtimes
+  int   nframes,         //number of frames (non-positive for all)
+  int   nx,              //number of columns
+  int   ny,              //number of rows
+  int   nz,              //number of channels
+  char  *out_transform,  //file for the transformations
+  char  *out_stransform, //file for the stabilizing transformations
+  int   verbose,         //switch on verbose mode
+  FILE  *log             //stream for verbose messages
+);
+
+
+/**
+ *
+ * Rendering half of the offline stabilization: it warps the frames in
+ * parallel with the transformations of a binary trajectory file
+ * It returns the number of frames processed
+ *
+**/
+int apply_stabilization(
+  video_reader &input,   //input video stream
+  video_writer &output,  //output video stream
+  char  *trajectory,     //input binary trajectory file
+  int   nthreads,        //number of threads
+  Timer &timer,          //manage runtimes
+  int   nframes,         //number of frames (non-positive for all)
+  int   nx,              //number of columns
+  int   ny,              //number of rows
+  int   nz,              //number of channels
+  int   verbose,         //switch on verbose mode
+  FILE  *log             //stream for verbose messages
+);
+
+
+#endif
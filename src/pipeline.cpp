@@ -0,0 +1,179 @@
+// This program is free software: you can use, modify and/or redistribute it
+// under the terms of the simplified BSD License. You should have received a
+// copy of this license along this program. If not, see
+// <http://www.opensource.org/licenses/bsd-license.html>.
+//
+// Copyright (C) 2019, Javier Sánchez Pérez <jsanchez@ulpgc.es>
+// All rights reserved.
+
+
+#include "pipeline.h"
+
+#include <algorithm>
+
+
+/**
+  *
+  * Reader stage: read the frames and compute their grayscale versions
+  * The color frames are warped as bytes, so they are not converted
+  * 
+**/
+void read_frames(
+  video_reader &input,            //input video stream
+  ring_buffer<frame_slot> &queue, //output queue
+  int nframes, //number of frames (non-positive for all)
+  int nx,      //number of columns 
+  int ny,      //number of rows
+  int nz       //number of channels
+)
+{
+  for(int f=0; nframes<=0 || f<nframes; f++)
+  {
+    frame_slot *s=queue.write_slot();
+    if(!input.read_frame(s->I)) break;
+    
+    rgb2gray(s->I, s->Ig, nx, ny, nz);
+    queue.push();
+  }
+  queue.close();
+}
+
+
+/**
+  *
+  * Writer stage: write the stabilized frames
+  * After a failed write, the frames are released without writing them,
+  * and the error is reported when the output is closed
+  * 
+**/
+void write_frames(
+  video_writer &output,           //output video stream
+  ring_buffer<frame_slot> &queue  //input queue
+)
+{
+  frame_slot *s;
+  bool ok=true;
+  while((s=queue.read_slot())!=NULL)
+  {
+    if(ok) ok=output.write_frame(s->Iw);
+    queue.pop();
+  }
+}
+
+
+/**
+  *
+  * Online video stabilization with a reader, a stabilizer and a writer
+  * running concurrently and joined by ring buffers of preallocated frames
+  * It returns the number of frames processed, or -1 if the transformations
+  * cannot be written
+  *
+**/
+int online_stabilization(
+  video_reader &input,   //input video stream
+  video_writer &output,  //output video stream
+  estadeo &stabilize,    //video stabilizer
+  Timer &timer,          //manage runtimes
+  int   nframes,         //number of frames (non-positive for all)
+  int   nx,              //number of columns 
+  int   ny,              //number of rows
+  int   nz,              //number of channels
+  char  *out_transform,  //file for the transformations
+  char  *out_stransform, //file for the stabilizing transformations
+  int   verbose,         //switch on verbose mode
+  FILE  *log             //stream for verbose messages
+)
+{
+  int fsize=nx*ny;
+  int csize=fsize*nz;
+  int nparams=stabilize.get_nparams();
+  
+  ring_buffer<frame_slot> in(PIPELINE_SIZE);
+  ring_buffer<frame_slot> out(PIPELINE_SIZE);
+
+  //preallocate the frames of both queues
+  for(int i=0; i<PIPELINE_SIZE; i++)
+  {
+    in.slot(i).I  =new unsigned char[csize];
+    in.slot(i).Iw =new unsigned char[csize];
+    in.slot(i).Ig =new float[fsize];
+    out.slot(i).I =new unsigned char[csize];
+    out.slot(i).Iw=new unsigned char[csize];
+    out.slot(i).Ig=new float[fsize];
+  }
+  float *I1=new float[fsize];
+
+  transform_writer wt(out_transform, nparams);
+  transform_writer ws(out_stransform, nparams);
+    
+  std::thread reader(
+    read_frames, std::ref(input), std::ref(in), nframes, nx, ny, nz
+  );
+  std::thread writer(write_frames, std::ref(output), std::ref(out));
+
+  int f=0;
+  frame_slot *s, *o=NULL;
+  while((s=in.read_slot())!=NULL)
+  {
+    //the first frame is written as it was read
+    if(f==0) std::swap(s->I, s->Iw);
+    else
+    {
+      //call the method for stabilizing the current frame
+      //this also finishes the warping of the previous frame
+      stabilize.process_frame(I1, s->Ig, s->I, s->Iw, timer, nx, ny, nz);
+
+      if(verbose) timer.print_time(f, log);
+      
+      //save the motion transformations 
+      if(wt.is_open())
+        wt.write(stabilize.get_H());
+
+      //save the stabilizing transformation
+      if(ws.is_open())
+        ws.write(stabilize.get_smooth_H());
+    }
+
+    //the previous frame is ready for the writer
+    if(o!=NULL) out.push();
+
+    //pass the buffers to the writer and keep the grayscale frame
+    o=out.write_slot();
+    std::swap(*s, *o);
+    std::swap(I1, o->Ig);
+    in.pop();
+    
+    f++;
+  }
+  
+  //wait for the last frame
+  stabilize.wait_warping();
+  if(o!=NULL) out.push();
+  out.close();
+  
+  reader.join();
+  writer.join();
+
+  //the buffered transformations are written when their files are closed
+  bool saved=wt.close();
+  saved=ws.close() && saved;
+
+  for(int i=0; i<PIPELINE_SIZE; i++)
+  {
+    delete []in.slot(i).I;
+    delete []in.slot(i).Iw;
+    delete []in.slot(i).Ig;
+    delete []out.slot(i).I;
+    delete []out.slot(i).Iw;
+    delete []out.slot(i).Ig;
+  }
+  delete []I1;
+
+  if(!saved)
+  {
+    fprintf(stderr, "Error: Cannot write the transformations.\n");
+    return -1;
+  }
+  
+  return f;
+}
@@ -0,0 +1,128 @@
+// This program is free software: you can use, modify and/or redistribute it
+// under the terms of the simplified BSD License. You should have received a
+// copy of this license along this program. If not, see
+// <http://www.opensource.org/licenses/bsd-license.html>.
+//
+// Copyright (C) 2019, Javier Sánchez Pérez <jsanchez@ulpgc.es>
+// All rights reserved.
+
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "estadeo.h"
+#include "utils.h"
+
+//number of frames in flight between two stages
+#define PIPELINE_SIZE 4
+
+
+/**
+ *
+ * Lock-free ring buffer of preallocated slots
+ * for a single producer and a single consumer
+ *
+**/
+template <class T>
+class ring_buffer {
+
+  public:
+  
+    ring_buffer(int n): size(n), head(0), tail(0), closed(false)
+    {
+      slots=new T[size];
+    }
+    
+    ~ring_buffer(){delete []slots;}
+    
+    //access to the slots for allocating and releasing their memory
+    T &slot(int i){return slots[i];}
+    
+    //wait for a free slot to be filled by the producer
+    T *write_slot()
+    {
+      unsigned long h=head.load(std::memory_order_relaxed);
+      for(int i=0; h-tail.load(std::memory_order_acquire)>=size; i++)
+        wait(i);
+      return &slots[h%size];
+    }
+    
+    //publish the slot filled by the producer
+    void push(){head.fetch_add(1, std::memory_order_release);}
+    
+    //the producer does not generate more slots
+    void close(){closed.store(true, std::memory_order_release);}
+    
+    //wait for the next filled slot; it returns NULL at the end of the stream
+    T *read_slot()
+    {
+      unsigned long t=tail.load(std::memory_order_relaxed);
+      for(int i=0; head.load(std::memory_order_acquire)==t; i++)
+      {
+        if(closed.load(std::memory_order_acquire) && 
+           head.load(std::memory_order_acquire)==t) 
+          return NULL;
+        wait(i);
+      }
+      return &slots[t%size];
+    }
+    
+    //release the slot read by the consumer
+    void pop(){tail.fetch_add(1, std::memory_order_release);}
+    
+  private:
+  
+    //spin for a while and then sleep to avoid burning a core
+    void wait(int i)
+    {
+      if(i<64) std::this_thread::yield();
+      else std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  
+    T    *slots; //preallocated slots
+    unsigned long size; //number of slots
+    std::atomic<unsigned long> head;  //number of slots pushed
+    std::atomic<unsigned long> tail;  //number of slots popped
+    std::atomic<bool>          closed;//end of stream
+};
+
+
+/**
+ *
+ * Frame travelling through the stages of the pipeline
+ *
+**/
+struct frame_slot {
+  unsigned char *I;  //color frame read
+  unsigned char *Iw; //color frame warped
+  float *Ig; //grayscale frame
+};
+
+
+/**
+ *
+ * Online video stabilization with a reader, a stabilizer and a writer
+ * running concurrently and joined by ring buffers of preallocated frames
+ *
+**/
+int online_stabilization(
+  video_reader &input,   //input video stream
+  video_writer &output,  //output video stream
+  estadeo &stabilize,    //video stabilizer
+  Timer &timer,          //manage runtimes
+  int   nframes,         //number of frames (non-positive for all)
+  int   nx,              //number of columns 
+  int   ny,              //number of rows
+  int   nz,              //number of channels
+  char  *out_transform,  //file for the transformations
+  char  *out_stransform, //file for the stabilizing transformations
+  int   verbose,         //switch on verbose mode
+  FILE  *log             //stream for verbose messages
+);
+
+
+#endif
@@ -0,0 +1,264 @@
+// This program is free software: you can use, modify and/or redistribute it
+// under the terms of the simplified BSD License. You should have received a
+// copy of this license along this program. If not, see
+// <http://www.opensource.org/licenses/bsd-license.html>.
+//
+// Copyright (C) 2019, Javier Sánchez Pérez <jsanchez@ulpgc.es>
+// All rights reserved.
+
+
+#include "segments.h"
+#include "estadeo.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+
+/**
+  *
+  * Function to write a stabilized frame in its position of the output 
+  * file or in the temporary file of the segment
+  * It returns false if the frame cannot be written
+  *
+**/
+bool write_segment_frame(
+  unsigned char *I,      //stabilized frame
+  int   csize,           //number of values of a frame
+  int   f,               //frame number
+  video_writer &output,  //output video file
+  FILE  *tmp             //temporary file of the segment (or NULL)
+)
+{
+  if(tmp!=NULL) 
+    return fwrite(I, sizeof(unsigned char), csize, tmp)==(size_t) csize;
+  else return output.write_frame(f, I);
+}
+
+
+/**
+  *
+  * Function to stabilize the frames [first, last) of a video file
+  * The stabilization starts radius frames before, so that the circular
+  * array of the smoothing holds the same transformations as in a single
+  * run when the first frame is reached
+  * It stops at the first frame that cannot be written
+  *
+**/
+void stabilize_segment(
+  video_reader &input,   //input video file
+  video_writer &output,  //output video stream
+  FILE  *tmp,            //temporary file of the segment (or NULL)
+  char  *written,        //output: all the frames were written
+  int   first,           //first frame of the segment
+  int   last,            //last frame of the segment (not included)
+  float *H,              //output transformations (or NULL)
+  float *Hs,             //output stabilizing transformations (or NULL)
+  int   nparams,         //number of parameters of the transformations
+  float sigma,           //Gaussian standard deviation
+  int   smoothing,       //motion smoothing strategy
+  int   nx,              //number of columns
+  int   ny,              //number of rows
+  int   nz               //number of channels
+)
+{
+  int fsize=nx*ny;
+  int csize=fsize*nz;
+
+  Timer timer;
+  estadeo stabilize(nparams, sigma, smoothing, 0);
+  int start=std::max(first-stabilize.obtain_radius(), 0);
+
+  //frames read and warped
+  unsigned char *I[2] ={new unsigned char[csize], new unsigned char[csize]};
+  unsigned char *Iw[2]={new unsigned char[csize], new unsigned char[csize]};
+  float *I1=new float[fsize];
+  float *I2=new float[fsize];
+
+  bool ok=true;
+  int c=0;
+  for(int f=start; f<last && ok && input.read_frame(f, I[c]); f++)
+  {
+    rgb2gray(I[c], I2, nx, ny, nz);
+
+    //the first frame of the video is not modified
+    if(f>start)
+    {
+      //this also finishes the warping of the previous frame
+      stabilize.process_frame(I1, I2, I[c], Iw[c], timer, nx, ny, nz);
+
+      if(f>=first && H!=NULL)
+        for(int i=0; i<nparams; i++)
+          H[f*nparams+i]=stabilize.get_H()[i];
+
+      if(f>=first && Hs!=NULL)
+        for(int i=0; i<nparams; i++)
+          Hs[f*nparams+i]=stabilize.get_smooth_H()[i];
+    }
+
+    //the previous frame is finished; the first one is not modified
+    if(f-1>=first)
+      ok=write_segment_frame(
+        (f-1>start)? Iw[1-c]: I[1-c], csize, f-1, output, tmp
+      );
+
+    std::swap(I1, I2);
+    c=1-c;
+  }
+
+  //wait for the last frame
+  stabilize.wait_warping();
+  if(ok && last-1>=first)
+    ok=write_segment_frame(
+      (last-1>start)? Iw[1-c]: I[1-c], csize, last-1, output, tmp
+    );
+
+  //the buffered frames of the temporary file may also fail
+  if(tmp!=NULL && fflush(tmp)!=0) ok=false;
+  *written=ok;
+
+  delete []I[0];
+  delete []I[1];
+  delete []Iw[0];
+  delete []Iw[1];
+  delete []I1;
+  delete []I2;
+}
+
+
+/**
+  *
+  * Online video stabilization of a video file split in segments that are
+  * processed in parallel. Each segment starts radius frames before its
+  * first frame, so that the result is the same as the one of a single run
+  * with the local matrix based smoothing; the recursive smoothing forgets
+  * the frames before the segment at the same rate as its filters
+  * The frames are written in their positions of the output file or, for
+  * streams, in a temporary file per segment that are copied in order
+  * It returns the number of frames processed, or -1 if the frames or the
+  * transformations cannot be written
+  *
+**/
+int segment_stabilization(
+  video_reader &input,   //input video file
+  video_writer &output,  //output video stream
+  int   nparams,         //number of parameters of the transformations
+  float sigma,           //Gaussian standard deviation
+  int   smoothing,       //motion smoothing strategy
+  int   nsegments,       //number of segments processed in parallel
+  Timer &timer,          //manage runtimes
+  int   nframes,         //number of frames (non-positive for all)
+  int   nx,              //number of columns
+  int   ny,              //number of rows
+  int   nz,              //number of channels
+  char  *out_transform,  //file for the transformations
+  char  *out_stransform, //file for the stabilizing transformations
+  int   verbose,         //switch on verbose mode
+  FILE  *log             //stream for verbose messages
+)
+{
+  if(!input.is_seekable())
+  {
+    fprintf(stderr, "Error: The segments mode needs an input video file.\n");
+    return 0;
+  }
+
+  int csize=nx*ny*nz;
+  int n=input.number_of_frames();
+  if(nframes>0 && nframes<n) n=nframes;
+  if(n==0) return 0;
+
+  if(nsegments>n) nsegments=n;
+  if(nsegments<1) nsegments=1;
+
+  if(verbose) timer.set_t1();
+
+  //temporary files of the segments of a stream
+  bool seekable=output.is_seekable();
+  std::vector<FILE *> tmp(nsegments, (FILE *) NULL);
+  for(int s=0; s<nsegments && !seekable; s++)
+    if((tmp[s]=tmpfile())==NULL)
+    {
+      fprintf(stderr, "Error: Cannot create the temporary files of the "
+              "segments.\n");
+      for(int k=0; k<s; k++) fclose(tmp[k]);
+      return -1;
+    }
+
+  //transformations of every frame, saved in order at the end
+  std::vector<float> H, Hs;
+  if(out_transform!=NULL)  H.resize(n*nparams);
+  if(out_stransform!=NULL) Hs.resize(n*nparams);
+
+  std::vector<std::thread> workers;
+  std::vector<char> written(nsegments, 0);
+  for(int s=0; s<nsegments; s++)
+  {
+    int first=(long long) s*n/nsegments;
+    int last =(long long) (s+1)*n/nsegments;
+
+    if(verbose)
+      fprintf(log, " Segment %d: frames %d to %d\n", s, first, last-1);
+
+    workers.push_back(std::thread(
+      stabilize_segment, std::ref(input), std::ref(output), tmp[s],
+      &written[s], first, last, H.empty()? NULL: &H[0], 
+      Hs.empty()? NULL: &Hs[0], nparams, sigma, smoothing, nx, ny, nz
+    ));
+  }
+
+  bool ok=true;
+  for(int s=0; s<nsegments; s++)
+  {
+    workers[s].join();
+    ok=ok && written[s];
+  }
+
+  if(verbose)
+  {
+    timer.set_t2();
+    timer.set_t3();
+  }
+
+  //copy the segments of a stream in order
+  if(!seekable)
+  {
+    unsigned char *I=new unsigned char[csize];
+    for(int s=0; s<nsegments; s++)
+    {
+      fseek(tmp[s], 0, SEEK_SET);
+      while(ok && 
+            fread(I, sizeof(unsigned char), csize, tmp[s])==(size_t) csize)
+        ok=output.write_frame(I);
+      fclose(tmp[s]);
+    }
+    delete []I;
+  }
+
+  if(!ok)
+  {
+    fprintf(stderr, "Error: Cannot write the stabilized segments.\n");
+    return -1;
+  }
+
+  //save the transformations of every frame but the first one
+  transform_writer wt(out_transform, nparams);
+  transform_writer ws(out_stransform, nparams);
+  for(int f=1; f<n; f++)
+  {
+    if(wt.is_open()) wt.write(&H[f*nparams]);
+    if(ws.is_open()) ws.write(&Hs[f*nparams]);
+  }
+
+  bool saved=wt.close();
+  saved=ws.close() && saved;
+  if(!saved)
+  {
+    fprintf(stderr, "Error: Cannot write the transformations.\n");
+    return -1;
+  }
+
+  if(verbose) timer.set_t4();
+
+  return n;
+}
@@ -0,0 +1,46 @@
+// This program is free software: you can use, modify and/or redistribute it
+// under the terms of the simplified BSD License. You should have received a
+// copy of this license along this program. If not, see
+// <http://www.opensource.org/licenses/bsd-license.html>.
+//
+// Copyright (C) 2019, Javier Sánchez Pérez <jsanchez@ulpgc.es>
+// All rights reserved.
+
+
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include <stdio.h>
+
+#include "utils.h"
+
+
+/**
+ *
+ * Online video stabilization of a video file split in segments that are
+ * processed in parallel. Each segment starts radius frames before its 
+ * first frame, so that the result is the same as the one of a single run
+ * It returns the number of frames processed, or -1 if the frames or the
+ * transformations cannot be written
+ *
+**/
+int segment_stabilization(
+  video_reader &input,   //input video file
+  video_writer &output,  //output video stream
+  int   nparams,         //number of parameters of the transformations
+  float sigma,           //Gaussian standard deviation
+  int   smoothing,       //motion smoothing strategy
+  int   nsegments,       //number of segments processed in parallel
+  Timer &timer,          //manage runtimes
+  int   nframes,         //number of frames (non-positive for all)
+  int   nx,              //number of columns
+  int   ny,              //number of rows
+  int   nz,              //number of channels
+  char  *out_transform,  //file for the transformations
+  char  *out_stransform, //file for the stabilizing transformations
+  int   verbose,         //switch on verbose mode
+  FILE  *log             //stream for verbose messages
+);
+
+
+#endif
@@ -0,0 +1,174 @@
+// This program is free software: you can use, modify and/or redistribute it
+// under the terms of the simplified BSD License. You should have received a
+// copy of this license along this program. If not, see
+// <http://www.opensource.org/licenses/bsd-license.html>.
+//
+// Copyright (C) 2019, Javier Sánchez Pérez <jsanchez@ulpgc.es>
+// All rights reserved.
+
+
+#include "trajectory.h"
+#include "transformation.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/**
+  *
+  *  Function to write the trajectory of a video to a binary file
+  *  It returns false if the file cannot be written
+  * 
+**/
+bool save_trajectory(
+  char  *name,   //file name
+  float *H,      //motion between each frame and the previous one
+  float *Hp,     //stabilizing transformation of each frame
+  int   nframes, //number of frames
+  int   nparams, //number of parameters of the transformations
+  int   nx,      //number of columns
+  int   ny       //number of rows
+)
+{
+  FILE *fd=fopen(name, "wb");
+  if(fd==NULL) return false;
+
+  trajectory_header header;
+  memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+  header.version=TRAJECTORY_VERSION;
+  header.nparams=nparams;
+  header.nframes=nframes;
+  header.nx=nx;
+  header.ny=ny;
+
+  size_t n=(size_t) nframes*nparams;
+  bool ok=fwrite(&header, sizeof(header), 1, fd)==1 &&
+          fwrite(H, sizeof(float), n, fd)==n &&
+          fwrite(Hp, sizeof(float), n, fd)==n;
+
+  return fclose(fd)==0 && ok;
+}
+
+
+/**
+  *
+  *  Function to write the motion of a video to a file of the cache
+  *  It returns false if the file cannot be written
+  * 
+**/
+bool save_motion(
+  char  *name,   //file name
+  float *H,      //motion between each frame and the previous one
+  int   nframes, //number of frames
+  int   nparams, //number of parameters of the transformations
+  int   nx,      //number of columns
+  int   ny       //number of rows
+)
+{
+  FILE *fd=fopen(name, "wb");
+  if(fd==NULL) return false;
+
+  trajectory_header header;
+  memcpy(header.magic, MOTION_MAGIC, sizeof(header.magic));
+  header.version=TRAJECTORY_VERSION;
+  header.nparams=nparams;
+  header.nframes=nframes;
+  header.nx=nx;
+  header.ny=ny;
+
+  size_t n=(size_t) nframes*nparams;
+  bool ok=fwrite(&header, sizeof(header), 1, fd)==1 &&
+          fwrite(H, sizeof(float), n, fd)==n;
+
+  return fclose(fd)==0 && ok;
+}
+
+
+/**
+  *
+  *  Function to read the motion of a video from a file of the cache
+  *  It returns false if the file does not exist or if it was computed
+  *  for other frames or another type of transformation
+  * 
+**/
+bool load_motion(
+  char  *name,           //file name
+  std::vector<float> &H, //output motion of every frame
+  int   nframes,         //expected number of frames
+  int   nparams,         //expected number of parameters
+  int   nx,              //expected number of columns
+  int   ny               //expected number of rows
+)
+{
+  FILE *fd=fopen(name, "rb");
+  if(fd==NULL) return false;
+
+  trajectory_header header;
+  bool ok=fread(&header, sizeof(header), 1, fd)==1 &&
+    memcmp(header.magic, MOTION_MAGIC, sizeof(header.magic))==0 &&
+    header.version==TRAJECTORY_VERSION && header.nparams==nparams &&
+    header.nframes==nframes && header.nx==nx && header.ny==ny;
+
+  if(ok)
+  {
+    size_t n=(size_t) nframes*nparams;
+    H.resize(n);
+    ok=fread(&H[0], sizeof(float), n, fd)==n;
+  }
+
+  fclose(fd);
+  return ok;
+}
+
+
+/**
+  *
+  *  Map a binary trajectory file in memory
+  *  The file is closed if its header or its size are not valid
+  * 
+**/
+trajectory_file::trajectory_file(
+  char *name //file name
+): data(NULL), length(0), header(NULL), H(NULL)
+{
+  int fd=open(name, O_RDONLY);
+  if(fd<0) return;
+
+  struct stat st;
+  if(fstat(fd, &st)==0 && (size_t) st.st_size>=sizeof(trajectory_header))
+  {
+    length=st.st_size;
+    data=mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    if(data==MAP_FAILED) data=NULL;
+  }
+  close(fd);
+
+  if(data==NULL) return;
+
+  //only the parametric models of the program and positive sizes
+  trajectory_header *h=(trajectory_header *) data;
+  bool model=
+    h->nparams==TRANSLATION_TRANSFORM || h->nparams==EUCLIDEAN_TRANSFORM ||
+    h->nparams==SIMILARITY_TRANSFORM  || h->nparams==AFFINITY_TRANSFORM  ||
+    h->nparams==HOMOGRAPHY_TRANSFORM;
+  size_t n=(size_t) h->nframes*h->nparams;
+  if(
+    memcmp(h->magic, TRAJECTORY_MAGIC, sizeof(h->magic))==0 &&
+    h->version==TRAJECTORY_VERSION && h->nframes>0 && model &&
+    h->nx>0 && h->ny>0 &&
+    length==sizeof(trajectory_header)+2*n*sizeof(float)
+  )
+  {
+    header=h;
+    H=(float *) (h+1);
+  }
+}
+
+trajectory_file::~trajectory_file()
+{
+  if(data!=NULL) munmap(data, length);
+}
@@ -0,0 +1,111 @@
+// This program is free software: you can use, modify and/or redistribute it
+// under the terms of the simplified BSD License. You should have received a
+// copy of this license along this program. If not, see
+// <http://www.opensource.org/licenses/bsd-license.html>.
+//
+// Copyright (C) 2019, Javier Sánchez Pérez <jsanchez@ulpgc.es>
+// All rights reserved.
+
+
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <stddef.h>
+
+#include <vector>
+
+//identifier and version of the binary trajectory files
+#define TRAJECTORY_MAGIC "ESTT"
+#define TRAJECTORY_VERSION 1
+
+//identifier of the motion files of the cache, with the same header
+#define MOTION_MAGIC "ESTM"
+
+
+//header of a binary trajectory file, followed by the motions H of the
+//frames and then by their stabilizing transformations Hp, as floats
+struct trajectory_header {
+  char magic[4]; //TRAJECTORY_MAGIC
+  int  version;  //TRAJECTORY_VERSION
+  int  nparams;  //number of parameters of the transformations
+  int  nframes;  //number of frames
+  int  nx;       //number of columns of the frames
+  int  ny;       //number of rows of the frames
+};
+
+
+/**
+ *
+ * Function to write the trajectory of a video to a binary file
+ *
+**/
+bool save_trajectory(
+  char  *name,   //file name
+  float *H,      //motion between each frame and the previous one
+  float *Hp,     //stabilizing transformation of each frame
+  int   nframes, //number of frames
+  int   nparams, //number of parameters of the transformations
+  int   nx,      //number of columns
+  int   ny       //number of rows
+);
+
+
+/**
+ *
+ * Functions to write and read the motion of a video, without the
+ * stabilizing transformations, in the files of the motion cache
+ *
+**/
+bool save_motion(
+  char  *name,   //file name
+  float *H,      //motion between each frame and the previous one
+  int   nframes, //number of frames
+  int   nparams, //number of parameters of the transformations
+  int   nx,      //number of columns
+  int   ny       //number of rows
+);
+
+bool load_motion(
+  char  *name,           //file name
+  std::vector<float> &H, //output motion of every frame
+  int   nframes,         //expected number of frames
+  int   nparams,         //expected number of parameters
+  int   nx,              //expected number of columns
+  int   ny               //expected number of rows
+);
+
+
+//class for reading a binary trajectory file mapped in memory
+class trajectory_file {
+
+  public:
+    trajectory_file(
+      char *name //file name
+    );
+    
+    ~trajectory_file();
+    
+    //the file owns its mapping, so it cannot be copied
+    trajectory_file(const trajectory_file &)=delete;
+    trajectory_file &operator=(const trajectory_file &)=delete;
+    
+    bool is_open(){return header!=NULL;}
+    
+    int number_of_frames(){return header->nframes;}
+    int number_of_parameters(){return header->nparams;}
+    int width(){return header->nx;}
+    int height(){return header->ny;}
+    
+    //motions and stabilizing transformations of all the frames
+    float *get_H(){return H;}
+    float *get_Hp(){return H+header->nframes*header->nparams;}
+    
+  private:
+    void   *data;   //mapped file
+    size_t length;  //size of the file
+    trajectory_header *header;
+    float  *H;
+};
+
+
+#endif
@@ -8,69 +8,389 @@
 
 
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+
+
+/**
+  *
+  *  Open a raw video for reading its frames one by one
+  *  The name "-" stands for the standard input
+  * 
+**/
+video_reader::video_reader(
+  char *name,     //file name
+  int  frame_size //number of bytes of each frame
+): tmp(NULL), size(frame_size)
+{
+  if(strcmp(name, "-")==0) fd=stdin;
+  else fd=fopen(name, "rb");
+}
+
+video_reader::~video_reader()
+{
+  if(fd!=NULL && fd!=stdin) fclose(fd);
+  if(tmp!=NULL) fclose(tmp);
+}
 
 
 /**
   *
-  *  Function to read a video in raw data
+  *  Function to read the next frame of the video
+  *  It returns false at the end of the stream
   * 
 **/
-size_t read_video(
-  char *name,       //file name
-  unsigned char *I, //video to read
-  int size          //size of the video
-) 
+bool video_reader::read_frame(
+  unsigned char *I //frame to read
+)
 {
-  FILE* file=fopen(name, "rb");
-  if(file != NULL)
+  if(fd==NULL) return false;
+  if(fread(I, sizeof(unsigned char), size, fd)!=size) return false;
+  
+  if(tmp!=NULL) fwrite(I, sizeof(unsigned char), size, tmp);
+  return true;
+}
+
+
+/**
+  *
+  *  Function to keep a copy of the frames that are read from a stream 
+  *  that cannot be rewound, like a pipe, in a temporary file
+  * 
+**/
+void video_reader::keep_frames()
+{
+  if(fd!=NULL && tmp==NULL && fseek(fd, 0, SEEK_CUR)!=0)
+    tmp=tmpfile();
+}
+
+
+/**
+  *
+  *  Function to read the video again from the first frame
+  *  The frames of a stream are read from their copy
+  * 
+**/
+bool video_reader::rewind()
+{
+  if(fd==NULL) return false;
+  
+  if(tmp!=NULL)
   {
-    size_t result=fread(I, sizeof(unsigned char), size, file);
-    fclose(file);
-    return result;
+    if(fd!=stdin) fclose(fd);
+    fd=tmp;
+    tmp=NULL;
   }
-  else return 0;
+  
+  return fseek(fd, 0, SEEK_SET)==0;
+}
+
+
+/**
+  *
+  *  Function to check if the frames can be read in any order
+  * 
+**/
+bool video_reader::is_seekable()
+{
+  struct stat st;
+  return fd!=NULL && fd!=stdin && tmp==NULL &&
+         fstat(fileno(fd), &st)==0 && S_ISREG(st.st_mode);
+}
+
+
+/**
+  *
+  *  Function to compute the number of frames of a video file
+  * 
+**/
+int video_reader::number_of_frames()
+{
+  struct stat st;
+  if(!is_seekable() || fstat(fileno(fd), &st)!=0) return 0;
+  return st.st_size/size;
+}
+
+
+/**
+  *
+  *  Function to read a frame of a video file by its number
+  *  Several threads can read frames at the same time
+  * 
+**/
+bool video_reader::read_frame(
+  int f,           //frame number
+  unsigned char *I //frame to read
+)
+{
+  if(fd==NULL) return false;
+  return pread(fileno(fd), I, size, (off_t) f*size)==(ssize_t) size;
 }
 
 
 /**
   *
-  *  Function to read a video in raw data
+  *  Open a raw video for writing its frames one by one
+  *  The name "-" stands for the standard output and NULL for no output
   * 
 **/
-size_t write_video(
-  char *name,       //file name
-  unsigned char *I, //video to write
-  int size          //size of the video
-) 
+video_writer::video_writer(
+  char *name,     //file name
+  int  frame_size //number of bytes of each frame
+): size(frame_size), failed(false)
 {
-  FILE* file=fopen(name, "wb");
-  if(file != NULL)
+  if(name==NULL) fd=NULL;
+  else if(strcmp(name, "-")==0) fd=stdout;
+  else fd=fopen(name, "wb");
+}
+
+video_writer::~video_writer()
+{
+  close();
+}
+
+
+/**
+  *
+  *  Function to flush and close the video
+  *  It returns false if any frame could not be written, including the 
+  *  errors of the buffered data, like a full disk or a closed pipe
+  * 
+**/
+bool video_writer::close()
+{
+  if(fd!=NULL)
   {
-    size_t result=fwrite(I, sizeof(unsigned char), size, file);
-    fclose(file);
-    return result;
+    if(fd==stdout) 
+    {
+      if(fflush(fd)!=0 || ferror(fd)) failed=true;
+    }
+    else if(fclose(fd)!=0) failed=true;
+    fd=NULL;
   }
-  else return 0;
+  return !failed;
+}
+
+
+/**
+  *
+  *  Function to write the next frame of the video
+  *  A failed write is remembered until the video is closed
+  * 
+**/
+bool video_writer::write_frame(
+  unsigned char *I //frame to write
+)
+{
+  if(fd==NULL) return false;
+  if(fwrite(I, sizeof(unsigned char), size, fd)==size) return true;
+  
+  failed=true;
+  return false;
+}
+
+
+/**
+  *
+  *  Function to check if the frames can be written in any order
+  * 
+**/
+bool video_writer::is_seekable()
+{
+  struct stat st;
+  return fd!=NULL && fd!=stdout &&
+         fstat(fileno(fd), &st)==0 && S_ISREG(st.st_mode);
+}
+
+
+/**
+  *
+  *  Function to write a frame of a video file by its number
+  *  Several threads can write frames at the same time
+  * 
+**/
+bool video_writer::write_frame(
+  int f,           //frame number
+  unsigned char *I //frame to write
+)
+{
+  if(fd==NULL) return false;
+  if(pwrite(fileno(fd), I, size, (off_t) f*size)==(ssize_t) size) return true;
+  
+  failed=true;
+  return false;
 }
 
 
 /**
   *
-  *  Function to save transformations to a file
+  *  Function for converting an rgb image to grayscale levels
   * 
 **/
-void save_transform(
+void rgb2gray(
+  float *rgb,  //input color image
+  float *gray, //output grayscale image
+  int nx,      //number of pixels
+  int ny, 
+  int nz
+)
+{
+  int size=nx*ny;
+  if(nz>=3)
+    #pragma omp parallel for
+    for(int i=0;i<size;i++)
+      gray[i]=(0.2989*rgb[i*nz]+0.5870*rgb[i*nz+1]+0.1140*rgb[i*nz+2]);
+  else
+    #pragma omp parallel for
+    for(int i=0;i<size;i++)
+      gray[i]=rgb[i];
+}
+
+
+/**
+  *
+  *  Function for converting an rgb image of bytes to grayscale levels
+  * 
+**/
+void rgb2gray(
+  unsigned char *rgb, //input color image
+  float *gray,        //output grayscale image
+  int nx,             //number of pixels
+  int ny, 
+  int nz
+)
+{
+  int size=nx*ny;
+  if(nz>=3)
+    #pragma omp parallel for
+    for(int i=0;i<size;i++)
+      gray[i]=(0.2989*rgb[i*nz]+0.5870*rgb[i*nz+1]+0.1140*rgb[i*nz+2]);
+  else
+    #pragma omp parallel for
+    for(int i=0;i<size;i++)
+      gray[i]=rgb[i];
+}
+
+
+/**
+  *
+  *  Function to add the value of sigma to a file name, before its 
+  *  extension, to name the outputs of a sweep of several sigmas
+  *  It returns NULL for a NULL name
+  * 
+**/
+char *sigma_file_name(
   char  *name,   //file name
-  float *H,      //transformation
-  int   nparams  //number of parameters of the transformations
+  float sigma,   //Gaussian standard deviation
+  char  *out,    //output file name
+  int   size     //size of the output name
 )
 {
-  FILE *fd=fopen(name,"a");
+  if(name==NULL) return NULL;
+
+  //the extension is after the last dot of the last component of the path
+  char *dot=strrchr(name, '.');
+  char *slash=strrchr(name, '/');
+  if(dot==NULL || (slash!=NULL && dot<slash)) dot=name+strlen(name);
+
+  snprintf(out, size, "%.*s_st%g%s", (int)(dot-name), name, sigma, dot);
+  return out;
+}
+
+
+/**
+  *
+  *  Open a file for writing transformations, appending them to its
+  *  previous contents
+  *  The names ending in ".bin" are written in binary
+  * 
+**/
+transform_writer::transform_writer(
+  char *name,   //file name (NULL for no file)
+  int  nparams  //number of parameters of the transformations
+): fd(NULL), nparams(nparams), binary(false), buffer(NULL), used(0),
+  failed(false)
+{
+  if(name==NULL) return;
+
+  size_t len=strlen(name);
+  binary=len>=4 && strcmp(name+len-4, ".bin")==0;
+
+  fd=fopen(name, binary? "ab": "a");
+  if(fd!=NULL) buffer=new char[TRANSFORM_BUFFER];
+  else failed=true;
+}
+
+transform_writer::~transform_writer()
+{
+  close();
+  delete []buffer;
+}
+
+
+/**
+  *
+  *  Function to write the buffered transformations and close the file
+  *  It returns false if the file could not be opened or any record could
+  *  not be written
+  * 
+**/
+bool transform_writer::close()
+{
   if(fd!=NULL)
   {
-    for(int j=0;j<nparams;j++) fprintf(fd, "%.10f ", H[j]);
-    fprintf(fd, "\n");
-    fclose(fd);
+    flush();
+    if(fclose(fd)!=0) failed=true;
+    fd=NULL;
   }
+  return !failed;
+}
+
+
+/**
+  *
+  *  Function to add the transformation of a frame to the buffer
+  *  The buffer is written when there is no space for another record
+  * 
+**/
+void transform_writer::write(
+  float *H      //transformation
+)
+{
+  if(fd==NULL) return;
+
+  //a text record takes at most a sign, 39 digits, the decimal point,
+  //10 decimals and a space per parameter
+  size_t record=binary? nparams*sizeof(float): nparams*52+1;
+  if(used+record>TRANSFORM_BUFFER) flush();
+
+  if(binary)
+  {
+    memcpy(buffer+used, H, nparams*sizeof(float));
+    used+=nparams*sizeof(float);
+  }
+  else
+  {
+    for(int j=0; j<nparams; j++)
+      used+=snprintf(buffer+used, TRANSFORM_BUFFER-used, "%.10f ", H[j]);
+    buffer[used++]='\n';
+  }
+}
+
+
+/**
+  *
+  *  Function to write the buffered transformations to the file
+  * 
+**/
+void transform_writer::flush()
+{
+  if(fd!=NULL && used>0 && 
+     fwrite(buffer, sizeof(char), used, fd)!=used)
+    failed=true;
+  used=0;
 }
 
@@ -5,25 +5,155 @@
 #include <stdio.h>
 #include <sys/time.h> 
 
+#include <atomic>
 
-size_t read_video(
-  char *name,       //file name
-  unsigned char *I, //video to read
-  int size          //size of the video
+
+//class for reading a raw video frame by frame
+class video_reader {
+
+  public:
+    video_reader(
+      char *name,     //file name
+      int  frame_size //number of bytes of each frame
+    );
+    
+    ~video_reader();
+    
+    //the reader owns its streams, so it cannot be copied
+    video_reader(const video_reader &)=delete;
+    video_reader &operator=(const video_reader &)=delete;
+    
+    bool is_open(){return fd!=NULL;}
+    
+    bool read_frame(
+      unsigned char *I //frame to read
+    );
+    
+    //keep a copy of the frames read from a stream that cannot be rewound
+    void keep_frames();
+    
+    //read again from the first frame
+    bool rewind();
+    
+    //random access to the frames of a file
+    bool is_seekable();
+    
+    int number_of_frames();
+    
+    bool read_frame(
+      int f,           //frame number
+      unsigned char *I //frame to read
+    );
+    
+  private:
+    FILE   *fd;   //input stream
+    FILE   *tmp;  //copy of the frames read from a stream
+    size_t size;  //number of bytes of each frame
+};
+
+
+//class for writing a raw video frame by frame
+class video_writer {
+
+  public:
+    video_writer(
+      char *name,     //file name
+      int  frame_size //number of bytes of each frame
+    );
+    
+    ~video_writer();
+    
+    //the writer owns its stream, so it cannot be copied
+    video_writer(const video_writer &)=delete;
+    video_writer &operator=(const video_writer &)=delete;
+    
+    bool is_open(){return fd!=NULL;}
+    
+    bool write_frame(
+      unsigned char *I //frame to write
+    );
+    
+    //random access to the frames of a file
+    bool is_seekable();
+    
+    bool write_frame(
+      int f,           //frame number
+      unsigned char *I //frame to write
+    );
+    
+    //flush and close the stream; false if any frame was not written
+    bool close();
+    
+  private:
+    FILE   *fd;   //output stream
+    size_t size;  //number of bytes of each frame
+    std::atomic<bool> failed; //a frame could not be written
+};
+
+void rgb2gray(
+  float *rgb,  //input color image
+  float *gray, //output grayscale image
+  int nx,      //number of pixels
+  int ny, 
+  int nz
 );
 
-size_t write_video(
-  char *name,       //file name
-  unsigned char *I, //video to write
-  int size          //size of the video
+void rgb2gray(
+  unsigned char *rgb, //input color image
+  float *gray,        //output grayscale image
+  int nx,             //number of pixels
+  int ny, 
+  int nz
 );
 
-void save_transform(
+char *sigma_file_name(
   char  *name,   //file name
-  float *H,      //transformation
-  int   nparams  //number of parameters of the transformations
+  float sigma,   //Gaussian standard deviation
+  char  *out,    //output file name
+  int   size     //size of the output name
 );
 
+//size of the buffer of the transformation files in bytes
+#define TRANSFORM_BUFFER 65536
+
+
+//class for writing transformations to a file that is kept open
+//The records are buffered in memory and written in batches, as text lines
+//or, for names ending in ".bin", as raw floats (nparams per frame)
+class transform_writer {
+
+  public:
+    transform_writer(
+      char *name,   //file name (NULL for no file)
+      int  nparams  //number of parameters of the transformations
+    );
+    
+    ~transform_writer();
+    
+    //the writer owns its file and its buffer, so it cannot be copied
+    transform_writer(const transform_writer &)=delete;
+    transform_writer &operator=(const transform_writer &)=delete;
+    
+    bool is_open(){return fd!=NULL;}
+    
+    void write(
+      float *H      //transformation
+    );
+    
+    void flush();
+    
+    //write the buffer and close the file; false if any record was lost
+    bool close();
+    
+  private:
+    FILE   *fd;     //output file
+    int    nparams; //number of parameters
+    bool   binary;  //raw floats instead of text
+    char   *buffer; //records not written yet
+    size_t used;    //number of bytes in the buffer
+    bool   failed;  //the file could not be opened or written
+};
+
 
 //class for recording runtimes of the method
 class Timer {
@@ -41,21 +171,21 @@ class Timer {
       avg3+=((t4.tv_sec-t3.tv_sec)*1000000u+t4.tv_usec-t3.tv_usec)/1.e6;
     }
     
-    void print_time(int f) {
-      printf(" Processing frame %d: T(%.4fs, %.7fs, %.4fs) \n", f, 
+    void print_time(int f, FILE *out=stdout) {
+      fprintf(out, " Processing frame %d: T(%.4fs, %.7fs, %.4fs) \n", f, 
             ((t2.tv_sec-t1.tv_sec)*1000000u+t2.tv_usec-t1.tv_usec)/1.e6,
             ((t3.tv_sec-t2.tv_sec)*1000000u+t3.tv_usec-t2.tv_usec)/1.e6,
             ((t4.tv_sec-t3.tv_sec)*1000000u+t4.tv_usec-t3.tv_usec)/1.e6);
     }
     
-    void print_avg_time(int nframes) {
+    void print_avg_time(int nframes, FILE *out=stdout) {
       float total=avg1+avg2+avg3;
       float average=(avg1+avg2+avg3)/nframes;
-      printf(
+      fprintf(out,
         "\n Average time per frame: %.4fs -> T(%.4fs, %.7fs, %.4fs) \n", 
         average, avg1/nframes, avg2/nframes, avg3/nframes
       ); 
-      printf(
+      fprintf(out,
         "\n Total time: %.4fs -> T(%.4fs, %.7fs, %.4fs) \n", 
         total, avg1, avg2, avg3
       ); 